@@ -1,621 +1,2084 @@
-/*
-  arduino_motor.cpp - Library for managing a DC motor with encoder
-*/
-
-#include "arduino_motor.h"
-
-// ==============================================================
-// PUBLIC
-
-// Constants
-const int PLUS = 0;
-const int MINUS = 1;
-
-// Constructor
-Arduino_Motor::Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd, int limit_rev, int span) {
-  
-  // Set type
-  __type = t;
-  
-  // Pin allocations
-  __direction = dir;
-  __pwm = pwm;
-  __sensor = sensor;
-  __limit_fwd = limit_fwd;
-  __limit_rev = limit_rev;
-  __span = span;
-  __event_func = func;
-
-  // Initialise pins
-  pinMode(__direction, OUTPUT);
-  pinMode(__pwm, OUTPUT);
-  pinMode(__limit_fwd, INPUT);
-  pinMode(__limit_rev, INPUT);
-  pinMode(__sensor, INPUT);
-  // Enable internal pullups on switches
-  digitalWrite(__limit_fwd, HIGH);
-  digitalWrite(__limit_rev, HIGH);
-  digitalWrite(__sensor, HIGH);
-
-  // Init vars
-  __calibrated = false;
-  // Default speeds
-  __speed = 100;
-  __backoff_speed = 100;
-  __abort = false;
-}
-
-Arduino_Motor::Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd_rev, int span) {
-  
-  // Set type
-  __type = t;
-  
-  // Pin allocations
-  __direction = dir;
-  __pwm = pwm;
-  __sensor = sensor;
-  __limit_fwd_rev = limit_fwd_rev;
-  // Set both to same pin
-  __limit_fwd = __limit_fwd_rev;
-  __limit_rev = __limit_fwd_rev;
-  __span = span;
-  __event_func = func;
-
-  // Initialise pins
-  pinMode(__direction, OUTPUT);
-  pinMode(__pwm, OUTPUT);
-  pinMode(__limit_fwd_rev, INPUT);
-  pinMode(__sensor, INPUT);
-  // Enable internal pullups on switches
-  digitalWrite(__limit_fwd_rev, HIGH);
-  digitalWrite(__sensor, HIGH);
-
-  // Init vars
-  __calibrated = false;
-  // Default speeds
-  __speed = 100;
-  __backoff_speed = 100;
-  __abort = false;
-}
-
-// ------------------------------------
-// Set speed
- void Arduino_Motor::set_speed(int duty_cycle) {
-    __speed = (int)(((float)duty_cycle/100.0) * 255);
- }
-
- void Arduino_Motor::set_backoff_speed(int duty_cycle) {
-    __backoff_speed = (int)(((float)duty_cycle/100.0) * 255);;
- }
-
-// ------------------------------------
-// Set calibration
- void Arduino_Motor::set_cal(int num_pulses) {
-  __num_pulses = num_pulses;
-  __pulses_per_degree = ((float)__num_pulses/(float)__span);
-  __pulse_cnt = 0;
-  __calibrated = true;
-  __degrees = 0;
- }
-
-// ------------------------------------
-// Calibrate the motor
-// Count number of pulses between limits
- int Arduino_Motor::calibrate() {
-
-  int cal, cal_fwd, cal_rev;
-
-  // We do two runs, counting forward and counting reverse
-  // These are usually different by maybe 70 pulses on a full 360.
-  // We take the average of the runs and use as the count.
-  cal_fwd = calibrate_fwd();
-  if (cal_fwd == -1) return -1;
-  delay(500);
-  cal_rev = calibrate_rev();
-  if (cal_rev == -1) return -1;
-  
-  // Use average
-  cal = (cal_fwd + cal_rev)/2;
-  __pulse_cnt = 0;
-  __calibrated = true;
-  __degrees = 0;
-  __num_pulses = cal;
-  __pulses_per_degree = ((float)__num_pulses/(float)__span);
-  __event_func(0);
-  Serial.print("Pulses: fwd, rev, final, per-degree");
-  Serial.println(cal_fwd);
-  Serial.println(cal_rev);
-  Serial.println(cal);
-  Serial.println(__pulses_per_degree);
-  return cal;
- }
-
- // ------------------------------------
-// Calibrate the motor in the forward direction
-// Count number of pulses between limits
- int Arduino_Motor::calibrate_fwd() {
-  volatile int num_pulses = 0;
-  // This leaves the motor at 'max' which is 360/90 deg (fully forward)
-  // We want the normal travel to avoid the limit switches as they cause over-travel
-  // so we count between just released limit switches
-
-  //----------------
-  // Run reverse at moderate speed until we hit reverse limit switch
-  __reverse(__speed);
-  if (!__wait_rev_limit()) {
-    __stop();
-    return -1;
-  }
-  __stop();
-  delay(500);
-  // Back off until reverse switch just releases
-  __forward(__backoff_speed);
-  if (!__wait_not_rev_limit()) {
-    __stop();
-    return -1;
-  }
-  __stop();
-  delay(500);
-
-  //----------------
-  // Now start counting
-  // Reset counters
-  __pulse_cnt = 0;
-  // Run forward at slowish speed until we hit forward limit switch
-  __forward(__speed);
-  // Wait for reverse limit switch and accumulate pulse count
-  while(__test_not_fwd_limit()) {
-    if(__read_sensor()) {
-      __pulse_cnt++;
-    } else {
-      __stop();
-      return -1;
-    }
-  }
-  __stop();
-  delay(500);
-
-  //----------------
-  // Remember initial total number of pulses and reset counters
-  // This is from just released forward switch to activated reverse switch
-  num_pulses = __pulse_cnt;
-  __pulse_cnt = 0;
-
-  //Serial.print("Initial num fwd pulses: ");
-  //Serial.println(num_pulses);
-  
-  //----------------
-  // Now back off until forward switch releases
-  __reverse(__backoff_speed);
-  // Wait for reverse limit switch off and accumulate pulse count
-  while(__test_fwd_limit()) {
-    if(__read_sensor()) {
-      __pulse_cnt++;
-    } else {
-      __stop();
-      return -1;
-    }
-  }
-  __stop();
-
-  //----------------
-  // Subtract the number of pulses we backed off by
-  // Return total number of pulses between just released limits
-  return num_pulses - __pulse_cnt;
- }
- 
-// ------------------------------------
-// Calibrate the motor in the reverse directiom
-// Count number of pulses between limits
- int Arduino_Motor::calibrate_rev() {
-  volatile int num_pulses = 0;
-  // This leaves the motor at 'home' which is 0 deg (fully reversed)
-  // ready for forward 0-span deg.
-  // We want the normal travel to avoid the limit switches as they cause over-travel
-  // so we count between just released limit switches
-
-  //----------------
-  // Run forward at moderate speed until we hit forward limit switch
-  __forward(__speed);
-  if (!__wait_fwd_limit()) {
-    __stop();
-    return -1;
-  }
-  __stop();
-  delay(500);
-  // Back off until forward switch just releases
-  __reverse(__backoff_speed);
-  if (!__wait_not_fwd_limit()) {
-    __stop();
-    return -1;
-  }
-  __stop();
-  delay(500);
-
-  //----------------
-  // Now start counting
-  // Reset counters
-  __pulse_cnt = 0;
-  // Run reverse at slowish speed until we hit reverse limit switch
-  __reverse(__speed);
-  // Wait for reverse limit switch and accumulate pulse count
-  while(__test_not_rev_limit()) {
-    if(__read_sensor()) {
-      __pulse_cnt++;
-    } else {
-      __stop();
-      return -1;
-    }
-  }
-  __stop();
-  delay(500);
-
-  //----------------
-  // Remember initial total number of pulses and reset counters
-  // This is from just released forward switch to activated reverse switch
-  num_pulses = __pulse_cnt;
-  __pulse_cnt = 0;
-
-  //Serial.print("Initial num rev pulses: ");
-  //Serial.println(num_pulses);
-  
-  //----------------
-  // Now back off until reverse switch releases
-  __forward(__backoff_speed);
-  // Wait for reverse limit switch off and accumulate pulse count
-  while(__test_rev_limit()) {
-    if(__read_sensor()) {
-      __pulse_cnt++;
-    } else {
-      __stop();
-      return -1;
-    }
-  }
-  __stop();
-  
-  //----------------
-  // Subtract the number of pulses we backed off by
-  // Return total number of pulses between just released limits
-  return  num_pulses - __pulse_cnt;
- }
- 
-// ------------------------------------
-// Move to home position
-bool Arduino_Motor::move_to_home() {
-  if(__calibrated) {
-    // Run reverse at moderate speed until we hit reverse limit switch
-    __reverse(__speed);
-    if (!__wait_rev_limit()) {
-      __stop();
-      return false;
-    }
-    __stop();
-    delay(500);
-    // Back off until reverse switch just releases
-    __forward(__backoff_speed);
-    if (!__wait_not_rev_limit()) {
-      __stop();
-      return false;
-    }
-    __stop();
-    delay(500);
-    __degrees = 0;
-    __event_func(0);
-    return true;
-  }
-  return false;
-}
-
-// ------------------------------------
-// Move to given position
-bool Arduino_Motor::move_to_position(int deg) {
-  // Local context
-  volatile int current_degrees;
-  volatile int degrees_to_move;
-  volatile int direction_to_move;
-  volatile int num_pulses;
-  volatile int pulses_to_move;
-  volatile float pulses_per_degree;
-  
-  //----------------
-  if(__calibrated) {
-    // Have calibration
-    // Parameter check and assign locals
-    current_degrees = __degrees;
-    pulses_per_degree = __pulses_per_degree;
-    if (deg < 0 or deg > __span){
-      return false;
-    }
-
-    //----------------
-    // Set direction
-    if (current_degrees < deg)
-      direction_to_move = PLUS;
-    else
-      direction_to_move = MINUS;
-
-    //----------------
-    // Move to new position  
-    degrees_to_move = abs(current_degrees - deg);
-    pulses_to_move = (int)(pulses_per_degree * (float)degrees_to_move);
-    num_pulses = pulses_to_move;
-    //Serial.println("Deg, Pulses, Direction, Fwd, Rev");
-    //Serial.println(degrees_to_move);
-    //Serial.println(pulses_to_move);
-    //Serial.println(direction_to_move);
-    //Serial.println(__test_not_fwd_limit());
-    //Serial.println(__test_not_rev_limit());
-    if (direction_to_move == PLUS) {
-      __forward(__speed);
-      while(__test_not_fwd_limit()) {
-        if(__read_sensor()) {
-            pulses_to_move--;
-            //Serial.print("Before fwd: ");
-            //Serial.println(pulses_to_move);
-            __do_event(current_degrees, deg, num_pulses, pulses_to_move);
-            //Serial.print("After fwd: ");
-            //Serial.println(pulses_to_move);
-            if (pulses_to_move <= 0)
-              break;
-        } else {
-          return false;
-        }
-      }
-    } else {
-      __reverse(__speed);
-      while(__test_not_rev_limit()) {
-        if(__read_sensor()) {
-            pulses_to_move--;
-            //Serial.print("Before rev: ");
-            //Serial.println(pulses_to_move);
-            __do_event(current_degrees, deg, num_pulses, pulses_to_move);
-            //Serial.print("After rev: ");
-            //Serial.println(pulses_to_move);
-            if (pulses_to_move <= 0)
-              break;
-        } else {
-          return false;
-        }
-      }
-    }
-    __stop();
-    //----------------
-    // Set new position 
-    __degrees = deg;
-
-    // Although the calibration should be between points that are clear of
-    // the limits we could have ended up with the limit activated. We must move away
-    // we either won't move or will end up rotating twice in the same direction!
-    // This should only occur if using a single limit switch for both directions.
-    //Serial.println(direction_to_move);
-    //Serial.println(__test_fwd_limit());
-    if ((direction_to_move == PLUS) && (__test_fwd_limit())) {
-      Serial.println("Nudge reverse");
-      // Move reverse a little to clear the switch
-      __reverse(__speed);
-      __wait_not_fwd_limit();
-      __stop();
-      } else if ((direction_to_move == MINUS) && (__test_rev_limit())) {
-        Serial.println("Nudge forward");
-        // Move forward a little to clear the switch
-        __forward(__speed);
-        __wait_not_rev_limit();
-        __stop();
-    }
-  } else {
-    // Not calibrated
-    return false;
-  }
-  return true;
-}
-
-// ------------------------------------
-// Nudge
-void Arduino_Motor::nudge_fwd() {
-  int count = 10;
-  if (__test_fwd_limit()) return;
-  __forward(__speed);
-  while(__test_not_fwd_limit()) {
-     if (count-- <= 0) break;
-     delay(10);  
-  }
-  __stop();
-}
-
-void Arduino_Motor::nudge_rev() {
-  int count = 10;
-  if (__test_rev_limit()) return;
-  __reverse(__speed);
-  while(__test_not_rev_limit()) {
-     if (count-- <= 0) break;
-     delay(10);  
-  }
-  __stop();
-}
-
-// ==============================================================
-// PRIVATE
-
-// ------------------------------------
-// Run forward at given speed
-void Arduino_Motor::__forward(int fwd_speed) {
-  digitalWrite(__direction, HIGH);
-  analogWrite(__pwm, fwd_speed);
-}
-
-// ------------------------------------
-// Run reverse at given speed
-void Arduino_Motor::__reverse(int rev_speed) {
-  digitalWrite(__direction, LOW);
-  analogWrite(__pwm, rev_speed);
-}
-
-// ------------------------------------
-// Stop motor
-void Arduino_Motor::__stop() {
-  analogWrite(__pwm, 0);
-}
-
-// ------------------------------------
-// Test forward limit switch
-bool Arduino_Motor::__test_fwd_limit() {
-  if (!digitalRead(__limit_fwd)) {
-    return true;
-  }
-  return false;
-}
-
-// ------------------------------------
-// Wait for forward limit switch
-// In this and all other waits we need a failsafe exit. Its possible due to 
-// incorrect wiring or a software error (especially during testing) that we
-// are moving the motor the wrong way or waiting for the wrong limit switch
-// to close. In this case we will try and destroy the switch or motor.
-// To aleviate this we always check for the other limit switch and immediately
-// stop the motor.
-bool Arduino_Motor::__wait_fwd_limit() {
-  int count = 20000; // 20 second timeout
-  while (digitalRead(__limit_fwd)) {
-    delay (1);
-    if (__test_rev_limit()) {
-      Serial.println("Detected reverse limit switch waiting for forward limit switch!");
-      __stop();
-      return false;
-    }
-    if (__abort) {
-      return false;
-    }
-    --count;
-    if (count <= 0) return false;
-  }
-  return true;
-}
-
-// ------------------------------------
-// Test reverse limit switch
-bool Arduino_Motor::__test_rev_limit() {
-  if (!digitalRead(__limit_rev)) {
-    return true;
-  }
-  return false;
-}
-
-// ------------------------------------
-// Wait for reverse limit switch
-bool Arduino_Motor::__wait_rev_limit() {
-  int count = 20000; // 20 second timeout
-  while (digitalRead(__limit_rev)) {
-    delay (1);
-    if (__test_fwd_limit()) {
-      Serial.println("Detected forward limit switch waiting for reverse limit switch!");
-      __stop();
-      return false;
-    }
-    if (__abort) {
-      return false;
-    }
-    --count;
-    if (count <= 0) return false;
-  }
-  return true;
-}
-
-// ------------------------------------
-// Test not forward limit switch
-bool Arduino_Motor::__test_not_fwd_limit() {
-  if (digitalRead(__limit_fwd)) {
-    return true;
-  }
-  return false;
-}
-
-// ------------------------------------
-// Wait for forward limit switch to release
-bool Arduino_Motor::__wait_not_fwd_limit() {
-  int count = 20000; // 20 second timeout
-  while (!digitalRead(__limit_fwd)) {
-    delay (1);
-    if (__test_rev_limit()) {
-      Serial.println("Detected reverse limit switch waiting for forward limit switch to release!");
-      __stop();
-      return false;
-    }
-    if (__abort) {
-      return false;
-    }
-    --count;
-    if (count <= 0) return false;
-  }
-  return true;
-}
-
-// ------------------------------------
-// Test not reverse limit switch
-bool Arduino_Motor::__test_not_rev_limit() {
-  if (digitalRead(__limit_rev)) {
-    return true;
-  }
-  return false;
-}
-
-// ------------------------------------
-// Wait for reverse limit switch to release
-bool Arduino_Motor::__wait_not_rev_limit() {
-  int count = 20000; // 20 second timeout
-  while (!digitalRead(__limit_rev)) {
-    delay (1);
-    if (__test_fwd_limit()) {
-      Serial.println("Detected forward limit switch waiting for reverse limit switch to release!");
-      __stop();
-      return false;
-    }
-    if (__abort) {
-      return false;
-    }
-    --count;
-    if (count <= 0) return false;
-  }
-  return true;
-}
-
-// ------------------------------------
-// Read sensor
-bool Arduino_Motor::__read_sensor() {
-  // If the motor is not movng we must have a timeout
-  // to avoid locking the system.
-  int count = 100;
-  // Wait for next pulse
-  if (!digitalRead(__sensor)) {
-    while (!digitalRead(__sensor)) {
-      if (--count <= 0) return false;
-      delay(1);
-    }
-  }
-  // Wait for end of pulse
-  count = 100;
-  while (digitalRead(__sensor)) {
-    if (--count <= 0) return false;
-    delay(1);
-  }
-    return true;
-}
-
-// ------------------------------------
-// Calculate current degrees and dispatch status event
-void Arduino_Motor::__do_event(int current_degrees, int deg, int num_pulses, int pulses_to_move) {
-  int idegrees;
-
-  //Serial.println("Current deg, deg, num pulses, pulses to move");
-  //Serial.println(current_degrees);
-  //Serial.println(deg);
-  //Serial.println(num_pulses);
-  //Serial.println(pulses_to_move);
-  
-  if (deg > current_degrees) {
-    // Moving forward
-    idegrees = current_degrees + ((int)((float)(num_pulses - pulses_to_move) / __pulses_per_degree));
-  } else {
-    idegrees = current_degrees - ((int)((float)(num_pulses - pulses_to_move) / __pulses_per_degree));
-  }
-  __event_func(idegrees);
-}
+/*
+  arduino_motor.cpp - Library for managing a DC motor with encoder
+*/
+
+#include <EEPROM.h>
+#include "arduino_motor.h"
+
+// ==============================================================
+// PUBLIC
+
+// Constants
+// Directions, !dir is the opposite direction
+const int PLUS = 0;
+const int MINUS = 1;
+
+// Operations run by the state machine
+const int OP_NONE = 0;
+const int OP_HOME = 1;
+const int OP_CAL_FWD = 2;
+const int OP_CAL_REV = 3;
+const int OP_CALIBRATE = 4;
+const int OP_MOVE = 5;
+const int OP_VERIFY = 6;
+const int OP_TRACK = 7;
+
+// Stages of a limit switch seek
+const int SEEK_SLOW = 0;   // At the normal speed
+const int SEEK_FAST = 1;   // Fast approach
+const int SEEK_RETRY = 2;  // Hit the switch fast, back off and approach again
+const int SEEK_CREEP = 3;  // Slow approach after backing off
+
+// Calibration record version, change when the layout changes
+const byte EE_VERSION = 0xA3;
+
+// Timeouts in ms
+const unsigned long LIMIT_TIMEOUT = 20000;  // Seek or release a limit switch
+const unsigned long SETTLE_WINDOW = 50;     // No pulses for this long after stopping
+const unsigned long SETTLE_MAX = 500;       // Longest wait to settle
+const unsigned long PID_PERIOD = 10;        // Closed loop sample period
+const unsigned long PID_SETTLE = 50;        // At rest on target
+const unsigned long STALL_MIN = 2000;       // Shortest stall time in us
+const unsigned long VMAP_SETTLE = 150;      // Speed map, settle at each PWM
+const unsigned long VMAP_STEP = 300;        // Speed map, time at each PWM
+const unsigned long SPEED_GAP = 100000;     // Stopped if no pulse for this long in us
+
+// Last event position before any event is sent, beyond any real position
+const long EVENT_NONE = -2147483647L - 1;
+
+#if defined(__AVR__)
+// Catch growth in the RAM used, raise MOTOR_FOOTPRINT deliberately
+static_assert(sizeof(Arduino_Motor) <= MOTOR_FOOTPRINT, "Arduino_Motor has grown");
+#endif
+
+// Instances registered for sensor interrupts, indexed by slot
+Arduino_Motor *Arduino_Motor::__isr_instance[MOTOR_MAX_ISR] = { 0 };
+
+// Constructor
+Arduino_Motor::Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd, int limit_rev, int span) {
+
+  // Set type
+  __type = t;
+
+  // Pin allocations
+  __direction = dir;
+  __pwm = pwm;
+  __sensor = sensor;
+  __limit_fwd = limit_fwd;
+  __limit_rev = limit_rev;
+  __span = span;
+  __event_func = func;
+
+  // Initialise pins
+  pinMode(__direction, OUTPUT);
+  pinMode(__pwm, OUTPUT);
+  pinMode(__limit_fwd, INPUT);
+  pinMode(__limit_rev, INPUT);
+  pinMode(__sensor, INPUT);
+  // Enable internal pullups on switches
+  digitalWrite(__limit_fwd, HIGH);
+  digitalWrite(__limit_rev, HIGH);
+  digitalWrite(__sensor, HIGH);
+
+  __init_vars();
+}
+
+Arduino_Motor::Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd_rev, int span) {
+
+  // Set type
+  __type = t;
+
+  // Pin allocations
+  __direction = dir;
+  __pwm = pwm;
+  __sensor = sensor;
+  __limit_fwd_rev = limit_fwd_rev;
+  // Set both to same pin
+  __limit_fwd = __limit_fwd_rev;
+  __limit_rev = __limit_fwd_rev;
+  __span = span;
+  __event_func = func;
+
+  // Initialise pins
+  pinMode(__direction, OUTPUT);
+  pinMode(__pwm, OUTPUT);
+  pinMode(__limit_fwd_rev, INPUT);
+  pinMode(__sensor, INPUT);
+  // Enable internal pullups on switches
+  digitalWrite(__limit_fwd_rev, HIGH);
+  digitalWrite(__sensor, HIGH);
+
+  __init_vars();
+}
+
+// Give up the interrupt slot
+Arduino_Motor::~Arduino_Motor() {
+  int slot;
+
+  for (slot = 0; slot < MOTOR_MAX_ISR; slot++) {
+    if (__isr_instance[slot] == this) {
+      detachInterrupt(digitalPinToInterrupt(__sensor));
+      __isr_instance[slot] = 0;
+    }
+  }
+}
+
+// ------------------------------------
+// Count sensor pulses in the background
+// The sensor pin must be interrupt capable. If sensor_b is given it is
+// sampled on each pulse to give a signed quadrature count.
+bool Arduino_Motor::use_interrupts(int sensor_b) {
+  int irq;
+  int slot;
+
+  irq = digitalPinToInterrupt(__sensor);
+  if (irq == NOT_AN_INTERRUPT) return false;
+  // Find a free slot, or the one we already hold
+  for (slot = 0; slot < MOTOR_MAX_ISR; slot++) {
+    if (__isr_instance[slot] == 0 || __isr_instance[slot] == this) break;
+  }
+  if (slot >= MOTOR_MAX_ISR) return false;
+
+  __sensor_b = sensor_b;
+  if (__sensor_b != -1) {
+    pinMode(__sensor_b, INPUT);
+    digitalWrite(__sensor_b, HIGH);
+  }
+  __map_pins();
+  __isr_count = 0;
+  __isr_last = 0;
+  __isr_instance[slot] = this;
+  // The polled reader counts on the falling edge at the end of a pulse
+  switch (slot) {
+    case 0: attachInterrupt(irq, __isr_0, FALLING); break;
+    case 1: attachInterrupt(irq, __isr_1, FALLING); break;
+    case 2: attachInterrupt(irq, __isr_2, FALLING); break;
+    case 3: attachInterrupt(irq, __isr_3, FALLING); break;
+  }
+  __isr_mode = true;
+  return true;
+}
+
+// ------------------------------------
+// Signed pulse count maintained by the ISR
+long Arduino_Motor::encoder_count() {
+  long count;
+  noInterrupts();
+  count = __isr_count;
+  interrupts();
+  return count;
+}
+
+// ------------------------------------
+// Set speed
+ void Arduino_Motor::set_speed(int duty_cycle) {
+    __speed = (int)(((float)duty_cycle/100.0) * 255);
+    __build_ramp();
+ }
+
+ void Arduino_Motor::set_backoff_speed(int duty_cycle) {
+    __backoff_speed = (int)(((float)duty_cycle/100.0) * 255);;
+ }
+
+// ------------------------------------
+// Set soft limits
+// Moves are kept margin pulses inside the limit switches and slow to the
+// backoff speed within decel pulses of the soft limits so the switches
+// are only reached if the position is out.
+void Arduino_Motor::set_soft_limits(int margin, int decel) {
+  __soft_margin = max(margin, 0);
+  __soft_decel = max(decel, 0);
+}
+
+// ------------------------------------
+// Number of times a move ended on a limit switch and had to nudge off
+unsigned long Arduino_Motor::nudge_count() {
+  return __nudge_count;
+}
+
+// ------------------------------------
+// Set a fast approach for limit switch seeks
+// Once calibrated the seek runs at duty_cycle until the position is within
+// slow_deg of the switch and then at the normal speed. Otherwise, or if the
+// switch is hit at speed, the motor backs off and approaches again at the
+// normal speed. A duty cycle of 0 seeks at the normal speed throughout.
+void Arduino_Motor::set_seek_speed(int duty_cycle, int slow_deg) {
+  __fast_speed = (int)(((float)duty_cycle/100.0) * 255);
+  __seek_slow = slow_deg;
+}
+
+// ------------------------------------
+// Set acceleration profile for moves
+// start_duty is the duty cycle the move starts and ends at.
+// accel is the maximum PWM increase per pulse in 1/16ths, 0 for no ramp.
+// jerk is the increase in accel per pulse in 1/16ths, 0 for a trapezoidal
+// profile, otherwise the acceleration itself ramps giving an S-curve.
+void Arduino_Motor::set_ramp(int start_duty, int accel, int jerk) {
+  __ramp_start = (int)(((float)start_duty/100.0) * 255);
+  __ramp_accel = accel;
+  __ramp_jerk = jerk;
+  __build_ramp();
+}
+
+// ------------------------------------
+// Closed loop position control
+// When enabled moves run a PID controller on the pulse count and correct
+// any overshoot rather than stopping when the count runs out.
+void Arduino_Motor::set_closed_loop(bool enable) {
+  __closed_loop = enable;
+}
+
+// ------------------------------------
+// Set PID gains in 1/256ths
+void Arduino_Motor::set_pid(int kp, int ki, int kd) {
+  __pid_kp = kp;
+  __pid_ki = ki;
+  __pid_kd = kd;
+}
+
+// ------------------------------------
+// Set the error in pulses that counts as on target
+void Arduino_Motor::set_deadband(int pulses) {
+  __pid_deadband = pulses;
+}
+
+// ------------------------------------
+// Set the PWM range used by the PID controller
+// min_duty is the least that will turn the motor. The set speed still
+// caps the output when it is lower than max_duty.
+void Arduino_Motor::set_pwm_limit(int min_duty, int max_duty) {
+  __pid_min = (int)(((float)min_duty/100.0) * 255);
+  __pid_max = (int)(((float)max_duty/100.0) * 255);
+}
+
+// ------------------------------------
+// Set calibration
+// Fails for a count that cannot be right, leaving the calibration as it was.
+ bool Arduino_Motor::set_cal(int num_pulses) {
+  if (num_pulses <= 0) return false;
+  __num_pulses = num_pulses;
+  __set_scale();
+  __pulse_cnt = 0;
+  __calibrated = true;
+  __position = 0;
+  return true;
+ }
+
+// ------------------------------------
+// Save calibration, speed map and current position to EEPROM
+// The record takes MOTOR_EE_SIZE bytes from addr. Only changed bytes are
+// written so this can be called after each move.
+bool Arduino_Motor::save_cal(int addr) {
+  byte rec[MOTOR_EE_SIZE];
+  int i;
+  unsigned int pps;
+
+  if (!__calibrated) return false;
+  rec[0] = EE_VERSION;
+  rec[1] = (byte)(__num_pulses & 0xFF);
+  rec[2] = (byte)((__num_pulses >> 8) & 0xFF);
+  rec[3] = (byte)(__span & 0xFF);
+  rec[4] = (byte)((__span >> 8) & 0xFF);
+  for (i = 0; i < 4; i++) rec[5 + i] = (byte)((__position >> (8 * i)) & 0xFF);
+  rec[9] = (byte)(__backlash & 0xFF);
+  rec[10] = (byte)((__backlash >> 8) & 0xFF);
+  // Speed map, PWM and pulses/s held to 16 bits
+  rec[11] = (byte)__vmap_len;
+  for (i = 0; i < MOTOR_VMAP_LEN; i++) {
+    pps = (i < __vmap_len) ? (unsigned int)min(__vmap_pps[i], 0xFFFFL) : 0;
+    rec[12 + 3 * i] = (byte)((i < __vmap_len) ? __vmap_pwm[i] : 0);
+    rec[13 + 3 * i] = (byte)(pps & 0xFF);
+    rec[14 + 3 * i] = (byte)((pps >> 8) & 0xFF);
+  }
+  rec[MOTOR_EE_SIZE - 1] = __crc8(rec, MOTOR_EE_SIZE - 1);
+  for (i = 0; i < MOTOR_EE_SIZE; i++) EEPROM.update(addr + i, rec[i]);
+  return true;
+}
+
+// ------------------------------------
+// Load calibration, speed map and last position from EEPROM
+// Fails if there is no valid record for this span.
+bool Arduino_Motor::load_cal(int addr) {
+  byte rec[MOTOR_EE_SIZE];
+  int i;
+
+  for (i = 0; i < MOTOR_EE_SIZE; i++) rec[i] = EEPROM.read(addr + i);
+  if (rec[0] != EE_VERSION) return false;
+  if (rec[MOTOR_EE_SIZE - 1] != __crc8(rec, MOTOR_EE_SIZE - 1)) return false;
+  if ((int)(rec[3] | (rec[4] << 8)) != __span) return false;
+  if (rec[11] > MOTOR_VMAP_LEN) return false;
+  if (busy()) return false;
+
+  if (!set_cal((int)(rec[1] | (rec[2] << 8)))) return false;
+  // Built unsigned, the sign comes from the cast to 32 bits so this also
+  // holds where long is wider
+  __position = (int32_t)((uint32_t)rec[5] | ((uint32_t)rec[6] << 8) | ((uint32_t)rec[7] << 16) | ((uint32_t)rec[8] << 24));
+  __backlash = (int)(rec[9] | (rec[10] << 8));
+  __vmap_len = rec[11];
+  for (i = 0; i < __vmap_len; i++) {
+    __vmap_pwm[i] = rec[12 + 3 * i];
+    __vmap_pps[i] = (long)(rec[13 + 3 * i] | ((unsigned int)rec[14 + 3 * i] << 8));
+  }
+  return true;
+}
+
+// ------------------------------------
+// Start up from stored calibration
+// Loads the calibration and then homes, checking that the home switch is
+// reached within tolerance pulses of where it should be. On failure the
+// motor is left uncalibrated and calibrate() must be run.
+// Blocking
+bool Arduino_Motor::restore_cal(int addr, int tolerance) {
+  if (!load_cal(addr)) return false;
+  if (!start_verify_home(tolerance)) return false;
+  return __run();
+}
+
+// ------------------------------------
+// Start a move to home checking the position on the way
+bool Arduino_Motor::start_verify_home(int tolerance) {
+  if (!__calibrated) return false;
+  __verify_tolerance = tolerance;
+  return __start(OP_VERIFY);
+}
+
+// ------------------------------------
+// Backlash compensation
+// When enabled a move that reverses the direction of travel first runs
+// on by the backlash before counting towards the target.
+void Arduino_Motor::set_backlash_comp(bool enable) {
+  __backlash_comp = enable;
+}
+
+// ------------------------------------
+// Set the backlash in pulses
+// calibrate() sets this from the free play found reversing off each switch.
+void Arduino_Motor::set_backlash(int pulses) {
+  __backlash = pulses;
+}
+
+// ------------------------------------
+// Backlash in pulses
+int Arduino_Motor::backlash() {
+  return __backlash;
+}
+
+// ------------------------------------
+// Set a handler for position events in centidegrees
+// Called alongside the degrees handler given to the constructor.
+void Arduino_Motor::set_event_cdeg(void (*func)(long cdeg)) {
+  __event_cdeg_func = func;
+}
+
+// ------------------------------------
+// Set which position events are sent
+// change is one of EVENT_ALL, EVENT_DEGREE or EVENT_CDEG. Events closer
+// together than min_interval ms or more than max_per_sec in a second are
+// dropped, 0 for no limit. The final position of an operation is always sent.
+void Arduino_Motor::set_event_policy(int change, unsigned int min_interval, unsigned int max_per_sec) {
+  __event_change = change;
+  __event_interval = min_interval;
+  __event_rate = max_per_sec;
+}
+
+// ------------------------------------
+// Number of events dropped by the event policy
+unsigned long Arduino_Motor::events_suppressed() {
+  return __events_suppressed;
+}
+
+// ------------------------------------
+// Current position
+int Arduino_Motor::position() {
+  return __cdeg_to_deg(__pulses_to_cdeg(__position));
+}
+
+long Arduino_Motor::position_cdeg() {
+  return __pulses_to_cdeg(__position);
+}
+
+// ------------------------------------
+// Calibrate the motor
+// Count number of pulses between limits
+// Blocking, returns the pulse count or -1 on failure
+ int Arduino_Motor::calibrate() {
+  if (!start_calibrate()) return -1;
+  if (!__run()) return -1;
+  return __num_pulses;
+ }
+
+// ------------------------------------
+// Calibrate the motor in the forward direction
+// This leaves the motor at 'max' which is 360/90 deg (fully forward)
+// We want the normal travel to avoid the limit switches as they cause over-travel
+// so we count between just released limit switches
+// Blocking, returns the pulse count or -1 on failure
+ int Arduino_Motor::calibrate_fwd() {
+  if (!__start(OP_CAL_FWD)) return -1;
+  if (!__run()) return -1;
+  return __cal_fwd;
+ }
+
+// ------------------------------------
+// Calibrate the motor in the reverse direction
+// This leaves the motor at 'home' which is 0 deg (fully reversed)
+// ready for forward 0-span deg.
+// Blocking, returns the pulse count or -1 on failure
+ int Arduino_Motor::calibrate_rev() {
+  if (!__start(OP_CAL_REV)) return -1;
+  if (!__run()) return -1;
+  return __cal_rev;
+ }
+
+// ------------------------------------
+// Move to home position
+// Blocking
+bool Arduino_Motor::move_to_home() {
+  if (!start_home()) return false;
+  return __run();
+}
+
+// ------------------------------------
+// Move to given position
+// Blocking
+bool Arduino_Motor::move_to_position(int deg) {
+  if (!start_move_to_position(deg)) return false;
+  return __run();
+}
+
+// ------------------------------------
+// Move to given position in centidegrees
+// Blocking
+bool Arduino_Motor::move_to_position_cdeg(long cdeg) {
+  if (!start_move_to_position_cdeg(cdeg)) return false;
+  return __run();
+}
+
+// ------------------------------------
+// Start a calibration
+// Both runs are done, counting forward and counting reverse.
+// Call update() until it returns false.
+bool Arduino_Motor::start_calibrate() {
+  return __start(OP_CALIBRATE);
+}
+
+// ------------------------------------
+// Start a move to the home position
+bool Arduino_Motor::start_home() {
+  if (!__calibrated) return false;
+  return __start(OP_HOME);
+}
+
+// ------------------------------------
+// Start a move to the given position
+bool Arduino_Motor::start_move_to_position(int deg) {
+  return start_move_to_position_cdeg((long)deg * 100);
+}
+
+// ------------------------------------
+// Start a move to the given position in centidegrees
+// The speed can be scaled down by scale/256 so that several motors
+// arrive together.
+bool Arduino_Motor::start_move_to_position_cdeg(long cdeg, int scale) {
+  if (!__calibrated) return false;
+  if (cdeg < 0 or cdeg > (long)__span * 100) return false;
+  if (busy()) return false;
+  // Count pulses from the coast after the last move first, in interrupt
+  // mode they would otherwise be taken from this move
+  if (__isr_mode) __sync_pulses();
+
+  //----------------
+  // Set direction
+  __move_target = __soft_clamp(__cdeg_to_pulses(cdeg));
+  if (__position < __move_target)
+    __move_dir = PLUS;
+  else
+    __move_dir = MINUS;
+
+  //----------------
+  // Pulses to move to new position
+  __move_pulses = (int)abs(__move_target - __position);
+  // Take up the slack in the gears if we are changing direction
+  __lash_left = 0;
+  if (__backlash_comp && __move_pulses > 0 && __move_dir != __drive_dir) {
+    __lash_left = __backlash;
+    __move_pulses += __backlash;
+  }
+  __pulses_to_move = __move_pulses;
+  __move_scale = constrain(scale, 1, 256);
+  return __start(OP_MOVE);
+}
+
+// ------------------------------------
+// Start tracking
+// The motor follows targets queued by track_target() until
+// stop_tracking() is called, blending from one to the next without
+// stopping. The trajectory starts from the current position.
+bool Arduino_Motor::start_tracking() {
+  if (!__calibrated) return false;
+  if (busy()) return false;
+  __trk_from = __position;
+  __trk_from_time = millis();
+  __trk_head = 0;
+  __trk_count = 0;
+  __trk_err = 0;
+  __trk_err_max = 0;
+  __trk_err_sum = 0;
+  __trk_err_n = 0;
+  __move_scale = 256;
+  __lash_left = 0;
+  return __start(OP_TRACK);
+}
+
+// ------------------------------------
+// Queue a tracking target in centidegrees to be reached at time at_ms
+// Times are millis() and must increase. With replace set the queue is
+// cleared and the new target takes over from where we should be now.
+// Returns false if the queue is full.
+bool Arduino_Motor::track_target(long cdeg, unsigned long at_ms, bool replace) {
+  long velocity;
+  unsigned long now;
+  int last;
+
+  if (__phase != MOTOR_TRACK) return false;
+  cdeg = constrain(cdeg, 0L, (long)__span * 100);
+  if (replace) {
+    now = millis();
+    __trk_from = __track_setpoint(now, &velocity);
+    __trk_from_time = now;
+    __trk_count = 0;
+  }
+  if (__trk_count >= MOTOR_TRACK_LEN) return false;
+  if (__trk_count > 0) {
+    last = (__trk_head + __trk_count - 1) % MOTOR_TRACK_LEN;
+    if ((long)(at_ms - __trk_time[last]) <= 0) return false;
+  }
+  last = (__trk_head + __trk_count) % MOTOR_TRACK_LEN;
+  __trk_pulses[last] = __soft_clamp(__cdeg_to_pulses(cdeg));
+  __trk_time[last] = at_ms;
+  __trk_count++;
+  return true;
+}
+
+// ------------------------------------
+// Stop tracking
+void Arduino_Motor::stop_tracking() {
+  if (__phase != MOTOR_TRACK) return;
+  __stop();
+  __move_pwm = 0;
+  __enter(MOTOR_DONE);
+}
+
+// ------------------------------------
+// Tracking error from the ideal trajectory in centidegrees
+// The current error is signed, max and mean are since start_tracking().
+long Arduino_Motor::tracking_error() {
+  return __pulses_to_cdeg(__trk_err);
+}
+
+long Arduino_Motor::tracking_error_max() {
+  return __pulses_to_cdeg(__trk_err_max);
+}
+
+long Arduino_Motor::tracking_error_mean() {
+  if (__trk_err_n == 0) return 0;
+  return __pulses_to_cdeg(__trk_err_sum / __trk_err_n);
+}
+
+// ------------------------------------
+// Time in ms a move to the given position would take at the set speed
+// Uses the speed map, or until the speed is known a relative time that
+// is only useful to compare moves. Returns 0 if the move is not possible.
+unsigned long Arduino_Motor::move_estimate(long cdeg) {
+  unsigned long pulses;
+  long pps;
+
+  if (!__calibrated || __speed <= 0) return 0;
+  if (cdeg < 0 or cdeg > (long)__span * 100) return 0;
+  pulses = (unsigned long)abs(__cdeg_to_pulses(cdeg) - __position);
+  pps = __pwm_to_pps(__speed);
+  if (pps <= 0) return (pulses << 8) / (unsigned long)__speed;
+  return (pulses * 1000UL) / (unsigned long)pps;
+}
+
+// ------------------------------------
+// Set the speed for moves in centidegrees per second
+// The PWM is taken from the speed map built by calibrate(). Returns false
+// if the speed is not yet known.
+bool Arduino_Motor::set_velocity(long cdeg_per_sec) {
+  int pwm;
+
+  if (!__calibrated || cdeg_per_sec <= 0) return false;
+  pwm = __pps_to_pwm(__cdeg_to_pulses(cdeg_per_sec));
+  if (pwm <= 0) return false;
+  __speed = pwm;
+  __build_ramp();
+  return true;
+}
+
+// ------------------------------------
+// Measured speed in centidegrees per second
+// Taken from the time between encoder pulses, 0 when stopped.
+long Arduino_Motor::speed_cdeg() {
+  unsigned long since, pps;
+
+  if (!__calibrated || __interval == 0) return 0;
+  since = micros() - __last_pulse;
+  if (since > SPEED_GAP) return 0;
+  // Slowing down if the next pulse is late
+  since = max(since, __interval);
+  pps = min((1000000UL + since / 2) / since, 0xFFFFUL);
+  return (long)__q16_mul(pps, __cdeg_per_pulse);
+}
+
+#ifdef MOTOR_STATS
+// ------------------------------------
+// Statistics for the last operation
+const Motor_Stats &Arduino_Motor::stats() {
+  return __stats;
+}
+
+// ------------------------------------
+// Print the statistics for the last operation on one line
+// ms, pulses, polls, interval min/avg/max us, max gap us, callback us,
+// nudges, error cdeg
+void Arduino_Motor::print_stats(Print &out) {
+  out.print("ms=");
+  out.print(__stats.duration);
+  out.print(" p=");
+  out.print(__stats.pulses);
+  out.print(" polls=");
+  out.print(__stats.polls);
+  out.print(" int=");
+  out.print(__stats.interval_min);
+  out.print("/");
+  out.print(__stats.intervals ? __stats.interval_sum / __stats.intervals : 0UL);
+  out.print("/");
+  out.print(__stats.interval_max);
+  out.print(" gap=");
+  out.print(__stats.max_gap);
+  out.print(" cb=");
+  out.print(__stats.callback_time);
+  out.print(" nudge=");
+  out.print(__stats.nudges);
+  out.print(" err=");
+  out.println(__stats.error);
+}
+#endif
+
+// ------------------------------------
+// Abort any operation in progress
+// The motor is stopped on the next update()
+void Arduino_Motor::abort() {
+  if (busy()) __abort = true;
+}
+
+// ------------------------------------
+// Advance the current operation
+// Call from loop() as often as possible while an operation is running.
+// Returns true while the operation is still in progress.
+bool Arduino_Motor::update() {
+  int pulses, lash;
+  unsigned long now, waited, quiet;
+
+  if (!busy()) return false;
+  if (__abort) {
+    __fail(MOTOR_FAULT_ABORT);
+    return false;
+  }
+
+  now = millis();
+  switch (__phase) {
+
+    //----------------
+    // Wait for the motor to come to rest after stopping
+    case MOTOR_PAUSE:
+      pulses = __poll_pulses();
+      // The coast after a stop is part of the calibration count, and the
+      // last one is off the home position
+      if (__next_phase == MOTOR_COUNT || __next_phase == MOTOR_UNCOUNT || __next_phase == MOTOR_DONE)
+        __pulse_cnt += pulses;
+      waited = micros() - __settle_start;
+      // Quiet since the later of the stop and the last pulse
+      quiet = min(waited, micros() - __last_pulse);
+      if (quiet >= (unsigned long)__settle_window * 1000 || waited >= (unsigned long)__settle_max * 1000) {
+        __settle_time += waited / 1000;
+        __enter(__next_phase);
+      }
+      break;
+
+    //----------------
+    // Run until we hit the limit switch in the seek direction
+    case MOTOR_SEEK:
+      __poll_pulses();
+      if (__seek_stage == SEEK_FAST && __calibrated && __seek_distance() <= __cdeg_to_pulses((long)__seek_slow * 100)) {
+        // Close to the switch, slow down for the final approach
+        __seek_stage = SEEK_SLOW;
+        __set_pwm(__speed);
+      }
+      if (__test_limit(__seek_dir)) {
+        __stop();
+        if (__seek_stage == SEEK_FAST) __seek_stage = SEEK_RETRY;
+        if (__op == OP_VERIFY && abs(__position) > __verify_tolerance) {
+          // Not where we thought we were
+          Serial.println("Stored position does not match home switch!");
+          __calibrated = false;
+          __fail(MOTOR_FAULT_POSITION);
+          break;
+        }
+        __pause(MOTOR_BACKOFF);
+      } else if (__limit_fwd != __limit_rev && __test_limit(!__seek_dir)) {
+        Serial.println("Detected opposite limit switch seeking limit switch!");
+        __fail(MOTOR_FAULT_WRONG_LIMIT);
+      } else if (now - __phase_start > LIMIT_TIMEOUT) {
+        __fail(MOTOR_FAULT_TIMEOUT);
+      } else if (__stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      }
+      break;
+
+    //----------------
+    // Back off until the limit switch just releases
+    case MOTOR_BACKOFF:
+      __poll_pulses();
+      if (!__test_limit(__seek_dir)) {
+        __stop();
+        __pulse_cnt = 0;
+        if (__seek_stage == SEEK_RETRY)
+          __pause(MOTOR_SEEK);
+        else if (__op == OP_HOME || __op == OP_VERIFY)
+          __pause(MOTOR_DONE);
+        else
+          __pause(MOTOR_COUNT);
+      } else if (__limit_fwd != __limit_rev && __test_limit(!__seek_dir)) {
+        Serial.println("Detected opposite limit switch waiting for limit switch to release!");
+        __fail(MOTOR_FAULT_WRONG_LIMIT);
+      } else if (now - __phase_start > LIMIT_TIMEOUT) {
+        __fail(MOTOR_FAULT_TIMEOUT);
+      } else if (__stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      }
+      break;
+
+    //----------------
+    // Count pulses until we hit the opposite limit switch
+    case MOTOR_COUNT:
+      pulses = __poll_pulses();
+      __pulse_cnt += pulses;
+      if (__vmap_step < MOTOR_VMAP_LEN) __vmap_sample(now);
+      if (__test_limit(!__seek_dir)) {
+        __stop();
+        // Keep what we have of the speed map
+        __vmap_step = MOTOR_VMAP_LEN;
+        // Pulses from just released switch to activated opposite switch,
+        // with the coast after the backoff stopped
+        __cal_count = __pulse_cnt;
+        // Count the coast past the switch
+        __pulse_cnt = 0;
+        __pause(MOTOR_UNCOUNT);
+      } else if (pulses == 0 && __stalled()) {
+        // Too little to turn a stiff drive, go on with the next step
+        if (__vmap_step < MOTOR_VMAP_LEN - 1) {
+          __vmap_next(now);
+          __last_pulse = micros();
+        } else {
+          __fail(MOTOR_FAULT_STALL);
+        }
+      }
+      break;
+
+    //----------------
+    // Back off until the opposite switch releases, counting pulses
+    case MOTOR_UNCOUNT:
+      pulses = __poll_pulses();
+      __pulse_cnt += pulses;
+      if (!__test_limit(!__seek_dir)) {
+        __stop();
+        // Backing off to the switch reverses, so the free play in the
+        // gears is taken up before the output moves back over the coast.
+        // What is left over once the coast is taken off is the backlash.
+        lash = max(__pulse_cnt, 0);
+        if (__seek_dir == MINUS) {
+          __cal_fwd = __cal_count;
+          __cal_lash = lash;
+        } else {
+          __cal_rev = __cal_count;
+          __cal_lash = (__op == OP_CALIBRATE) ? (__cal_lash + lash + 1) / 2 : lash;
+        }
+        if (__cal_count <= 0) {
+          // Nothing to scale positions by
+          __fail(MOTOR_FAULT_COUNT);
+        } else if (__op == OP_CALIBRATE && __seek_dir == MINUS) {
+          // Now do the reverse run
+          __seek_dir = PLUS;
+          __pause(MOTOR_SEEK);
+        } else {
+          // Settle before finishing, home is where the switch released
+          __pulse_cnt = 0;
+          __pause(MOTOR_DONE);
+        }
+      } else if (pulses == 0 && __stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      }
+      break;
+
+    //----------------
+    // Count down pulses to the new position
+    case MOTOR_MOVE:
+      if (__limit_ahead(__move_dir)) {
+        __end_move();
+        break;
+      }
+      pulses = __poll_pulses();
+      if (pulses > 0) {
+        __pulses_to_move -= pulses;
+        __do_event(false);
+        if (__pulses_to_move <= 0) {
+          __end_move();
+        } else {
+          __ramp_speed();
+        }
+      } else if (__stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      }
+      break;
+
+    //----------------
+    // Closed loop move to the target pulse count
+    case MOTOR_SERVO:
+      pulses = __poll_pulses();
+      if (pulses > 0) __do_event(false);
+      if (__move_pwm != 0 && __limit_ahead(__drive_dir)) {
+        // A target at the switch is reached like any other, settle there
+        if (abs(__move_target - __position) <= __pid_deadband) {
+          __pid_hold(__move_target - __position);
+        } else {
+          __move_dir = __drive_dir;
+          __end_move();
+        }
+      } else if (now - __phase_start > LIMIT_TIMEOUT) {
+        __fail(MOTOR_FAULT_TIMEOUT);
+      } else if (pulses == 0 && __stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      } else if (now - __pid_time >= PID_PERIOD) {
+        __pid_time = now;
+        __servo();
+      }
+      break;
+
+    //----------------
+    // Follow the queued targets
+    case MOTOR_TRACK:
+      pulses = __poll_pulses();
+      if (pulses > 0) __do_event(false);
+      if (pulses == 0 && __stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      } else if (now - __pid_time >= PID_PERIOD) {
+        __pid_time = now;
+        __track_step(now);
+      }
+      break;
+
+    //----------------
+    // Move off a limit switch we stopped on
+    case MOTOR_NUDGE:
+      __poll_pulses();
+      if (!__test_limit(__move_dir)) {
+        __stop();
+        __enter(MOTOR_DONE);
+      } else if (now - __phase_start > LIMIT_TIMEOUT) {
+        __fail(MOTOR_FAULT_TIMEOUT);
+      } else if (__stalled()) {
+        __fail(MOTOR_FAULT_STALL);
+      }
+      break;
+  }
+  return busy();
+}
+
+// ------------------------------------
+// Set settle detection
+// After stopping the motor is taken to be at rest once no pulse has
+// arrived for window_ms, or after max_ms whatever happens.
+void Arduino_Motor::set_settle(unsigned int window_ms, unsigned int max_ms) {
+  __settle_window = window_ms;
+  __settle_max = max_ms;
+}
+
+// ------------------------------------
+// Time in ms spent waiting to settle during the last operation
+unsigned long Arduino_Motor::settle_time() {
+  return __settle_time;
+}
+
+// ------------------------------------
+// Set stall detection
+// A stall is a gap between pulses of more than multiple times the
+// expected interval, or start_ms when starting from rest.
+void Arduino_Motor::set_stall(int multiple, unsigned int start_ms) {
+  __stall_multiple = multiple;
+  __stall_start = start_ms;
+}
+
+// ------------------------------------
+// Fault for the last failed operation, one of the MOTOR_FAULT_ values
+int Arduino_Motor::fault() {
+  return __fault;
+}
+
+// ------------------------------------
+// Current state, one of the MOTOR_ states
+int Arduino_Motor::state() {
+  return __phase;
+}
+
+// ------------------------------------
+// True while an operation is in progress
+bool Arduino_Motor::busy() {
+  return __phase != MOTOR_IDLE && __phase != MOTOR_DONE && __phase != MOTOR_FAILED;
+}
+
+// ------------------------------------
+// Nudge
+void Arduino_Motor::nudge_fwd() {
+  int count = 10;
+  if (__test_fwd_limit()) return;
+  __forward(__speed);
+  while(__test_not_fwd_limit()) {
+     if (count-- <= 0) break;
+     delay(10);
+  }
+  __stop();
+}
+
+void Arduino_Motor::nudge_rev() {
+  int count = 10;
+  if (__test_rev_limit()) return;
+  __reverse(__speed);
+  while(__test_not_rev_limit()) {
+     if (count-- <= 0) break;
+     delay(10);
+  }
+  __stop();
+}
+
+// ==============================================================
+// PRIVATE
+
+// ------------------------------------
+// Initialise instance vars
+void Arduino_Motor::__init_vars() {
+  __calibrated = false;
+  // Default speeds
+  __speed = 100;
+  __backoff_speed = 100;
+  __fast_speed = 0;
+  __seek_slow = 20;
+  // No soft limits
+  __soft_margin = 0;
+  __soft_decel = 0;
+  __nudge_count = 0;
+  // No speed map yet
+  __interval = 0;
+  __vmap_len = 0;
+  __vmap_step = MOTOR_VMAP_LEN;
+  __abort = false;
+  // Polled sensor until interrupts are requested
+  __isr_mode = false;
+  __sensor_b = -1;
+  __map_pins();
+  __isr_count = 0;
+  __isr_last = 0;
+  // Nothing running
+  __op = OP_NONE;
+  __phase = MOTOR_IDLE;
+  __cal_fwd = 0;
+  __cal_rev = 0;
+  __cal_lash = 0;
+  __move_scale = 256;
+  __verify_tolerance = 0;
+  __backlash_comp = false;
+  __backlash = 0;
+  __lash_left = 0;
+  // Stall after 4 expected intervals or 100ms from rest
+  __fault = MOTOR_FAULT_NONE;
+  __pwm_out = 0;
+  __last_pulse = 0;
+  __last_poll = 0;
+  __speed_up = 0;
+  __stall_k = 0;
+  __stall_multiple = 4;
+  __stall_start = 100;
+  // Settle detection
+  __settle_window = SETTLE_WINDOW;
+  __settle_max = SETTLE_MAX;
+  __settle_time = 0;
+  // Not tracking
+  __trk_head = 0;
+  __trk_count = 0;
+  __trk_err = 0;
+  __trk_err_max = 0;
+  __trk_err_sum = 0;
+  __trk_err_n = 0;
+#ifdef MOTOR_STATS
+  memset(&__stats, 0, sizeof(__stats));
+#endif
+  __num_pulses = 0;
+  __cdeg_per_pulse = 0;
+  __pulses_per_cdeg = 0;
+  __event_cdeg_func = 0;
+  // Events on a change of degree
+  __event_change = EVENT_DEGREE;
+  __event_interval = 0;
+  __event_rate = 0;
+  __event_cdeg = EVENT_NONE;
+  __event_time = 0;
+  __event_window = 0;
+  __event_window_cnt = 0;
+  __events_suppressed = 0;
+  // No ramp
+  __ramp_start = 0;
+  __ramp_accel = 0;
+  __ramp_jerk = 0;
+  __build_ramp();
+  // Open loop, modest gains
+  __position = 0;
+  __drive_dir = PLUS;
+  __closed_loop = false;
+  __pid_kp = 256;
+  __pid_ki = 8;
+  __pid_kd = 512;
+  __pid_deadband = 2;
+  __pid_min = 40;
+  __pid_max = 255;
+}
+
+// ------------------------------------
+// Start an operation
+bool Arduino_Motor::__start(int op) {
+  if (busy()) return false;
+  __op = op;
+  __abort = false;
+  __fault = MOTOR_FAULT_NONE;
+  __settle_time = 0;
+  __seek_stage = SEEK_SLOW;
+  // Calibration builds a new speed map
+  if (op == OP_CALIBRATE || op == OP_CAL_FWD || op == OP_CAL_REV) __vmap_step = 0;
+#ifdef MOTOR_STATS
+  memset(&__stats, 0, sizeof(__stats));
+  __stats.interval_min = 0xFFFFFFFFUL;
+  __stats_start = millis();
+  __stats_poll = micros();
+#endif
+  if (op != OP_MOVE) __lash_left = 0;
+  if (op == OP_MOVE) {
+    // Nothing to do
+    if (__closed_loop) {
+      __enter(MOTOR_SERVO);
+      return true;
+    }
+    if (__pulses_to_move <= 0) {
+      __phase = MOTOR_DONE;
+      return true;
+    }
+    __enter(MOTOR_MOVE);
+    return true;
+  }
+  if (op == OP_TRACK) {
+    __enter(MOTOR_TRACK);
+    return true;
+  }
+  // The forward run and home start at the reverse limit,
+  // the reverse run at the forward limit
+  if (op == OP_CAL_REV)
+    __seek_dir = PLUS;
+  else
+    __seek_dir = MINUS;
+  __enter(MOTOR_SEEK);
+  return true;
+}
+
+// ------------------------------------
+// Run the current operation to completion
+bool Arduino_Motor::__run() {
+  while (update());
+  return __phase == MOTOR_DONE;
+}
+
+// ------------------------------------
+// Enter a new phase
+void Arduino_Motor::__enter(int phase) {
+  __phase = phase;
+  __phase_start = millis();
+#ifdef MOTOR_STATS
+  // Sampling gaps are measured within a phase
+  __stats_poll = micros();
+#endif
+  switch (phase) {
+    case MOTOR_SEEK:
+      // Run at moderate speed until we hit the limit switch, fast while
+      // the switch is far away
+      if (__seek_stage == SEEK_RETRY)
+        __seek_stage = SEEK_CREEP;
+      else if (__fast_speed > __speed && (!__calibrated || __seek_distance() > __cdeg_to_pulses((long)__seek_slow * 100)))
+        __seek_stage = SEEK_FAST;
+      else
+        __seek_stage = SEEK_SLOW;
+      __drive(__seek_dir, (__seek_stage == SEEK_FAST) ? __fast_speed : __speed);
+      break;
+    case MOTOR_BACKOFF:
+      // Back off until the switch just releases
+      __drive(!__seek_dir, __backoff_speed);
+      break;
+    case MOTOR_COUNT:
+      // Run at slowish speed to the opposite limit switch counting pulses,
+      // on from the coast counted while pausing
+      __sync_pulses();
+      if (__vmap_step < MOTOR_VMAP_LEN) {
+        // Build the speed map on the way
+        __vmap_len = 0;
+        __vmap_measuring = false;
+        __vmap_time = __phase_start;
+        __drive(!__seek_dir, __vmap_level(__vmap_step));
+      } else {
+        __drive(!__seek_dir, __speed);
+      }
+      break;
+    case MOTOR_UNCOUNT:
+      // Back off from the opposite limit switch counting pulses, less
+      // the coast past the switch
+      __pulse_cnt = -__pulse_cnt;
+      __sync_pulses();
+      __drive(__seek_dir, __backoff_speed);
+      break;
+    case MOTOR_MOVE:
+      __sync_pulses();
+      __move_pwm = min(__ramp_pwm(0), __move_speed());
+      if (__in_decel_zone(__move_dir)) __move_pwm = min(__move_pwm, __backoff_speed);
+      __drive(__move_dir, __move_pwm);
+      break;
+    case MOTOR_SERVO:
+    case MOTOR_TRACK:
+      __sync_pulses();
+      __pid_time = __phase_start;
+      __pid_e = __move_target - __position;
+      __pid_i = 0;
+      __move_pwm = 0;
+      break;
+    case MOTOR_NUDGE:
+      // Move the other way a little to clear the switch
+      __nudge_count++;
+#ifdef MOTOR_STATS
+      __stats.nudges++;
+#endif
+      __drive(!__move_dir, __speed);
+      break;
+    case MOTOR_DONE:
+      __finish();
+      break;
+  }
+}
+
+// ------------------------------------
+// Clamp a target in pulses to the soft limits
+long Arduino_Motor::__soft_clamp(long pulses) {
+  long hi;
+
+  hi = (long)__num_pulses - __soft_margin;
+  if (hi < __soft_margin) return pulses;
+  return constrain(pulses, (long)__soft_margin, hi);
+}
+
+// ------------------------------------
+// Test for being close to the soft limit in the given direction
+bool Arduino_Motor::__in_decel_zone(int dir) {
+  if (__soft_decel == 0 || !__calibrated) return false;
+  if (dir == PLUS)
+    return __position >= (long)__num_pulses - __soft_margin - __soft_decel;
+  return __position <= (long)__soft_margin + __soft_decel;
+}
+
+// ------------------------------------
+// Estimated pulses to the limit switch we are seeking
+long Arduino_Motor::__seek_distance() {
+  if (__seek_dir == PLUS)
+    return (long)__num_pulses - __position;
+  return __position;
+}
+
+// ------------------------------------
+// Wait for the motor to settle before entering the next phase
+void Arduino_Motor::__pause(int next_phase) {
+  __phase = MOTOR_PAUSE;
+  __next_phase = next_phase;
+  __settle_start = micros();
+}
+
+// ------------------------------------
+// Stop and fail the current operation with the given fault
+void Arduino_Motor::__fail(int fault) {
+  __stop();
+  __fault = fault;
+  __abort = false;
+  __phase = MOTOR_FAILED;
+#ifdef MOTOR_STATS
+  __stats_end();
+#endif
+  // Let the client know where we stopped
+  if (__calibrated && __op != OP_CALIBRATE && __op != OP_CAL_FWD && __op != OP_CAL_REV) __do_event(true);
+}
+
+// ------------------------------------
+// Stop at the end of a move and set the new position
+void Arduino_Motor::__end_move() {
+  __stop();
+
+  // Although the calibration should be between points that are clear of
+  // the limits we could have ended up with the limit activated. We must move away
+  // we either won't move or will end up rotating twice in the same direction!
+  // This should only occur if using a single limit switch for both directions.
+  if (__limit_ahead(__move_dir)) {
+    if (__move_dir == PLUS)
+      Serial.println("Nudge reverse");
+    else
+      Serial.println("Nudge forward");
+    __enter(MOTOR_NUDGE);
+  } else {
+    __enter(MOTOR_DONE);
+  }
+}
+
+// ------------------------------------
+// Complete the current operation
+void Arduino_Motor::__finish() {
+  int cal;
+
+#ifdef MOTOR_STATS
+  __stats_end();
+#endif
+
+  if (__op == OP_HOME || __op == OP_VERIFY) {
+    __position = 0;
+    __do_event(true);
+  } else if (__op == OP_CALIBRATE) {
+    // The two runs are usually different by a few pulses. We take the
+    // average of the runs as the count and of the free play measured at
+    // each end as the backlash.
+    cal = (__cal_fwd + __cal_rev)/2;
+    __backlash = __cal_lash;
+    __calibrated = true;
+    // Off home by the coast, which was forward
+    __position = __pulse_cnt;
+    __pulse_cnt = 0;
+    __num_pulses = cal;
+    __set_scale();
+    __do_event(true);
+    Serial.print("Pulses: fwd, rev, final, per-100-degrees, backlash");
+    Serial.println(__cal_fwd);
+    Serial.println(__cal_rev);
+    Serial.println(cal);
+    Serial.println((long)cal * 100 / __span);
+    Serial.println(__backlash);
+  } else if (__op == OP_MOVE || __op == OP_TRACK) {
+    __do_event(true);
+  }
+}
+
+// ------------------------------------
+// Build the ramp table
+// The table holds the PWM to use a given number of pulses from the start
+// or end of a move, one entry every 2^__ramp_shift pulses. The first half
+// of the ramp follows the acceleration profile and the second half mirrors
+// it so an S-curve eases into the top speed.
+void Arduino_Motor::__build_ramp() {
+  long v, a, top, mid;
+  int p, half, len, i, j;
+
+  __ramp_len = 0;
+  __ramp_shift = 0;
+  if (__ramp_accel <= 0 || __ramp_start >= __speed) return;
+
+  // Find the number of pulses to reach half way in 1/16ths of PWM
+  top = (long)__speed << 4;
+  mid = (((long)__ramp_start << 4) + top) / 2;
+  v = (long)__ramp_start << 4;
+  a = 0;
+  for (half = 0; v < mid; half++) {
+    if (__ramp_jerk > 0)
+      a = min(a + __ramp_jerk, (long)__ramp_accel);
+    else
+      a = __ramp_accel;
+    v += a;
+  }
+  // Scale so the full ramp fits the table
+  while (((2 * half) >> __ramp_shift) >= MOTOR_RAMP_LEN - 1) __ramp_shift++;
+  len = ((2 * half) >> __ramp_shift) + 1;
+
+  // First half
+  v = (long)__ramp_start << 4;
+  a = 0;
+  i = 0;
+  for (p = 0; p <= half; p++) {
+    if ((p & ((1 << __ramp_shift) - 1)) == 0) __ramp[i++] = (byte)(v >> 4);
+    if (__ramp_jerk > 0)
+      a = min(a + __ramp_jerk, (long)__ramp_accel);
+    else
+      a = __ramp_accel;
+    v += a;
+  }
+  // Second half mirrors the first
+  for (; i < len; i++) {
+    j = ((2 * half) - (i << __ramp_shift)) >> __ramp_shift;
+    __ramp[i] = (byte)(__ramp_start + __speed - __ramp[j]);
+  }
+  __ramp[len - 1] = (byte)__speed;
+  __ramp_len = len;
+}
+
+// ------------------------------------
+// PWM allowed the given number of pulses from the start or end of a move
+int Arduino_Motor::__ramp_pwm(int pulses) {
+  int i;
+
+  if (__ramp_len == 0) return __speed;
+  i = pulses >> __ramp_shift;
+  if (i >= __ramp_len) return __speed;
+  return __ramp[i];
+}
+
+// ------------------------------------
+// Top speed for the current move
+// Scaled by pulse rate when the speed is known as PWM is not linear.
+int Arduino_Motor::__move_speed() {
+  long pps;
+  int pwm;
+
+  if (__move_scale < 256) {
+    pps = (__pwm_to_pps(__speed) * __move_scale) >> 8;
+    pwm = __pps_to_pwm(pps);
+    if (pwm > 0) return min(pwm, __speed);
+  }
+  return (int)(((long)__speed * __move_scale) >> 8);
+}
+
+// ------------------------------------
+// Set the PWM for the current point in the move
+// Accelerate from the start and decelerate into the target.
+void Arduino_Motor::__ramp_speed() {
+  int pwm;
+
+  if (__ramp_len == 0 && __soft_decel == 0) return;
+  pwm = min(__ramp_pwm(__move_pulses - __pulses_to_move), __ramp_pwm(__pulses_to_move));
+  pwm = min(pwm, __move_speed());
+  if (__in_decel_zone(__move_dir)) pwm = min(pwm, __backoff_speed);
+  if (pwm != __move_pwm) {
+    __move_pwm = pwm;
+    __set_pwm(pwm);
+  }
+}
+
+// ------------------------------------
+// One step of the closed loop controller
+void Arduino_Motor::__servo() {
+  long e;
+
+  e = __move_target - __position;
+  if (abs(e) <= __pid_deadband) {
+    // On target, wait for the motor to come to rest
+    __pid_hold(e);
+    if (micros() - __last_pulse >= PID_SETTLE * 1000) {
+      __enter(MOTOR_DONE);
+    }
+    return;
+  }
+  // Past the target the integral from the approach only pushes further on
+  if ((e < 0) != (__pid_e < 0)) __pid_i = 0;
+  __servo_drive(__pid(e, 0));
+}
+
+// ------------------------------------
+// One step of the tracking controller
+// The PID works on the error from the ideal trajectory with the segment
+// velocity fed forward so the motor keeps moving between targets.
+void Arduino_Motor::__track_step(unsigned long now) {
+  long setpoint, velocity, e, out;
+
+  setpoint = __track_setpoint(now, &velocity);
+  e = setpoint - __position;
+
+  // Tracking error
+  __trk_err = e;
+  if (abs(e) > __trk_err_max) __trk_err_max = abs(e);
+  __trk_err_sum += abs(e);
+  __trk_err_n++;
+
+  if (velocity == 0 && abs(e) <= __pid_deadband) {
+    __pid_hold(e);
+    return;
+  }
+  out = __pid(e, __ff_pwm(velocity));
+  // Never drive into a limit switch
+  if (out > 0 && __limit_ahead(PLUS)) out = 0;
+  if (out < 0 && __limit_ahead(MINUS)) out = 0;
+  __servo_drive(out);
+}
+
+// ------------------------------------
+// Ideal position now on the tracking trajectory
+// The trajectory runs in straight lines between queued targets and holds
+// at the last one. Returns pulses and sets velocity in pulses/s.
+long Arduino_Motor::__track_setpoint(unsigned long now, long *velocity) {
+  long to, dp;
+  unsigned long dt, span_t;
+
+  // Move on to the next segment once a target time has passed
+  while (__trk_count > 0 && (long)(now - __trk_time[__trk_head]) >= 0) {
+    __trk_from = __trk_pulses[__trk_head];
+    __trk_from_time = __trk_time[__trk_head];
+    __trk_head = (__trk_head + 1) % MOTOR_TRACK_LEN;
+    __trk_count--;
+  }
+  if (__trk_count == 0) {
+    *velocity = 0;
+    return __trk_from;
+  }
+
+  to = __trk_pulses[__trk_head];
+  dp = to - __trk_from;
+  span_t = __trk_time[__trk_head] - __trk_from_time;
+  dt = now - __trk_from_time;
+  *velocity = (dp * 1000) / (long)span_t;
+  // Keep the product inside 32 bits
+  while (span_t > 32767) {
+    span_t >>= 1;
+    dt >>= 1;
+  }
+  return __trk_from + (dp * (long)dt) / (long)span_t;
+}
+
+// ------------------------------------
+// Signed PWM to run at the given velocity in pulses/s
+long Arduino_Motor::__ff_pwm(long velocity) {
+  long pwm;
+
+  if (velocity == 0) return 0;
+  pwm = __pps_to_pwm(abs(velocity));
+  return (velocity < 0) ? -pwm : pwm;
+}
+
+// ------------------------------------
+// Pulses/s expected at the given PWM, 0 if not known
+// Interpolates the speed map, or uses the pulse interval learnt by the
+// stall detector before a map has been built.
+long Arduino_Motor::__pwm_to_pps(int pwm) {
+  int i;
+
+  if (__vmap_len == 0) {
+    if (__stall_k == 0) return 0;
+    return (long)(((unsigned long)pwm * 1000000UL) / __stall_k);
+  }
+  if (__vmap_len == 1) return (__vmap_pps[0] * pwm) / __vmap_pwm[0];
+  // Segment containing pwm, or the end segment to extrapolate from
+  for (i = 1; i < __vmap_len - 1 && pwm > __vmap_pwm[i]; i++);
+  return max(0L, __vmap_pps[i - 1] + ((__vmap_pps[i] - __vmap_pps[i - 1]) * (pwm - __vmap_pwm[i - 1])) / (__vmap_pwm[i] - __vmap_pwm[i - 1]));
+}
+
+// ------------------------------------
+// PWM to run at the given pulses/s, 0 if not known
+long Arduino_Motor::__pps_to_pwm(long pps) {
+  long pwm;
+  int i;
+
+  if (__vmap_len == 0) {
+    if (__stall_k == 0) return 0;
+    pwm = (long)(((unsigned long)pps * (__stall_k / 100)) / 10000UL);
+  } else if (__vmap_len == 1) {
+    pwm = (pps * __vmap_pwm[0]) / __vmap_pps[0];
+  } else {
+    for (i = 1; i < __vmap_len - 1 && pps > __vmap_pps[i]; i++);
+    pwm = __vmap_pwm[i - 1] + ((long)(__vmap_pwm[i] - __vmap_pwm[i - 1]) * (pps - __vmap_pps[i - 1])) / (__vmap_pps[i] - __vmap_pps[i - 1]);
+  }
+  return constrain(pwm, 0L, 255L);
+}
+
+// ------------------------------------
+// PWM for a step of the speed map
+// The steps run from half the calibration speed up to it so the motor is
+// never driven faster than the sketch asked for.
+int Arduino_Motor::__vmap_level(int step) {
+  int lo;
+
+  lo = min(max(__pid_min, __speed / 2), __speed);
+  return lo + ((__speed - lo) * step) / (MOTOR_VMAP_LEN - 1);
+}
+
+// ------------------------------------
+// Build the speed map during the calibration count
+// Each PWM step is held for VMAP_STEP and the pulse rate measured once the
+// motor has settled. The count ends at the normal speed.
+void Arduino_Motor::__vmap_sample(unsigned long now) {
+  long pps;
+  int pwm;
+
+  if (!__vmap_measuring) {
+    if (now - __vmap_time >= VMAP_SETTLE) {
+      __vmap_measuring = true;
+      __vmap_mark = __pulse_cnt;
+      __vmap_mark_time = now;
+    }
+    return;
+  }
+  if (now - __vmap_time < VMAP_STEP) return;
+  pps = ((long)(__pulse_cnt - __vmap_mark) * 1000L) / (long)(now - __vmap_mark_time);
+  pwm = __vmap_level(__vmap_step);
+  // Keep the map increasing in both PWM and speed
+  if (pps > 0 && (__vmap_len == 0 || (pwm > __vmap_pwm[__vmap_len - 1] && pps > __vmap_pps[__vmap_len - 1]))) {
+    __vmap_pwm[__vmap_len] = pwm;
+    __vmap_pps[__vmap_len] = pps;
+    __vmap_len++;
+  }
+  __vmap_next(now);
+}
+
+// ------------------------------------
+// Move on to the next step of the speed map, the last runs at the speed
+void Arduino_Motor::__vmap_next(unsigned long now) {
+  __vmap_step++;
+  __vmap_measuring = false;
+  __vmap_time = now;
+  __set_pwm((__vmap_step < MOTOR_VMAP_LEN) ? __vmap_level(__vmap_step) : __speed);
+}
+
+// ------------------------------------
+// PID output for the given error plus a feed forward term
+// Integer PID on the pulse count. The integral is only accumulated while
+// the output is not saturated to stop it winding up on long moves. The
+// output never exceeds the set speed, as an open loop move.
+long Arduino_Motor::__pid(long e, long ff) {
+  long d, out, out_max, out_min, i_max;
+  bool saturated;
+
+  d = e - __pid_e;
+  __pid_e = e;
+  out = (((long)__pid_kp * e + (long)__pid_ki * __pid_i + (long)__pid_kd * d) >> 8) + ff;
+  saturated = false;
+  out_max = ((long)min(__pid_max, __speed) * __move_scale) >> 8;
+  if (out > out_max) {
+    out = out_max;
+    saturated = true;
+  } else if (out < -out_max) {
+    out = -out_max;
+    saturated = true;
+  }
+  if (!saturated && __pid_ki > 0) {
+    __pid_i += e;
+    i_max = (out_max << 8) / __pid_ki;
+    __pid_i = constrain(__pid_i, -i_max, i_max);
+  }
+  // Enough to turn the motor
+  out_min = min((long)__pid_min, out_max);
+  if (out > 0 && out < out_min) out = out_min;
+  if (out < 0 && out > -out_min) out = -out_min;
+  return out;
+}
+
+// ------------------------------------
+// Stop on target and reset the controller
+void Arduino_Motor::__pid_hold(long e) {
+  __pid_i = 0;
+  __pid_e = e;
+  if (__move_pwm != 0) {
+    __stop();
+    __move_pwm = 0;
+  }
+}
+
+// ------------------------------------
+// Drive the motor from a signed PID output
+void Arduino_Motor::__servo_drive(long out) {
+  // Without quadrature we can only tell direction from the drive so the
+  // motor must come to rest before it is driven the other way
+  if (!(__isr_mode && __sensor_b != -1) && out != 0 && (out > 0) != (__drive_dir == PLUS)) {
+    if (micros() - __last_pulse < PID_SETTLE * 1000) {
+      out = 0;
+    }
+  }
+
+  if (out == 0) {
+    if (__move_pwm != 0) {
+      __stop();
+      __move_pwm = 0;
+    }
+  } else if (out > 0) {
+    __move_pwm = (int)out;
+    if (__in_decel_zone(PLUS)) __move_pwm = min(__move_pwm, __backoff_speed);
+    __drive(PLUS, __move_pwm);
+  } else {
+    __move_pwm = (int)-out;
+    if (__in_decel_zone(MINUS)) __move_pwm = min(__move_pwm, __backoff_speed);
+    __drive(MINUS, __move_pwm);
+  }
+}
+
+// ------------------------------------
+// Run in given direction at given speed
+void Arduino_Motor::__drive(int dir, int speed) {
+  if (dir == PLUS)
+    __forward(speed);
+  else
+    __reverse(speed);
+}
+
+// ------------------------------------
+// Run forward at given speed
+void Arduino_Motor::__forward(int fwd_speed) {
+  __drive_dir = PLUS;
+  digitalWrite(__direction, HIGH);
+  __set_pwm(fwd_speed);
+}
+
+// ------------------------------------
+// Run reverse at given speed
+void Arduino_Motor::__reverse(int rev_speed) {
+  __drive_dir = MINUS;
+  digitalWrite(__direction, LOW);
+  __set_pwm(rev_speed);
+}
+
+// ------------------------------------
+// Stop motor
+void Arduino_Motor::__stop() {
+  __set_pwm(0);
+}
+
+// ------------------------------------
+// Set motor PWM
+// Speeding up gives the stall detector time for the motor to get up to
+// the new speed.
+void Arduino_Motor::__set_pwm(int pwm) {
+  if (pwm > __pwm_out) {
+    __speed_up = micros();
+    if (__pwm_out == 0) __last_pulse = __speed_up;
+  }
+  __pwm_out = pwm;
+  analogWrite(__pwm, pwm);
+}
+
+// ------------------------------------
+// Test limit switch in given direction
+bool Arduino_Motor::__test_limit(int dir) {
+  if (dir == PLUS)
+    return __test_fwd_limit();
+  return __test_rev_limit();
+}
+
+// ------------------------------------
+// Test for a limit switch ahead in the given direction
+// A single switch is made at both ends of the travel so it only counts at
+// the end we are heading for, otherwise we are driving off it.
+bool Arduino_Motor::__limit_ahead(int dir) {
+  if (!__test_limit(dir)) return false;
+  if (__limit_fwd != __limit_rev || !__calibrated) return true;
+  if (dir == PLUS) return __position > (long)__num_pulses / 2;
+  return __position < (long)__num_pulses / 2;
+}
+
+// ------------------------------------
+// Test forward limit switch
+bool Arduino_Motor::__test_fwd_limit() {
+  if (!__read_fwd_limit()) {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------
+// Test reverse limit switch
+bool Arduino_Motor::__test_rev_limit() {
+  if (!__read_rev_limit()) {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------
+// Test not forward limit switch
+bool Arduino_Motor::__test_not_fwd_limit() {
+  if (__read_fwd_limit()) {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------
+// Test not reverse limit switch
+bool Arduino_Motor::__test_not_rev_limit() {
+  if (__read_rev_limit()) {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------
+// Look up the port register and bit for each input pin
+// Done once so the hot paths are a single register read.
+void Arduino_Motor::__map_pins() {
+#ifdef MOTOR_FAST_IO
+  __sensor_in = portInputRegister(digitalPinToPort(__sensor));
+  __sensor_mask = digitalPinToBitMask(__sensor);
+  __fwd_in = portInputRegister(digitalPinToPort(__limit_fwd));
+  __fwd_mask = digitalPinToBitMask(__limit_fwd);
+  __rev_in = portInputRegister(digitalPinToPort(__limit_rev));
+  __rev_mask = digitalPinToBitMask(__limit_rev);
+  if (__sensor_b != -1) {
+    __sensor_b_in = portInputRegister(digitalPinToPort(__sensor_b));
+    __sensor_b_mask = digitalPinToBitMask(__sensor_b);
+  } else {
+    __sensor_b_in = 0;
+    __sensor_b_mask = 0;
+  }
+#endif
+}
+
+// ------------------------------------
+// Read input pins
+int Arduino_Motor::__read_sensor() {
+#ifdef MOTOR_FAST_IO
+  return (*__sensor_in & __sensor_mask) ? HIGH : LOW;
+#else
+  return digitalRead(__sensor);
+#endif
+}
+
+int Arduino_Motor::__read_sensor_b() {
+#ifdef MOTOR_FAST_IO
+  return (*__sensor_b_in & __sensor_b_mask) ? HIGH : LOW;
+#else
+  return digitalRead(__sensor_b);
+#endif
+}
+
+int Arduino_Motor::__read_fwd_limit() {
+#ifdef MOTOR_FAST_IO
+  return (*__fwd_in & __fwd_mask) ? HIGH : LOW;
+#else
+  return digitalRead(__limit_fwd);
+#endif
+}
+
+int Arduino_Motor::__read_rev_limit() {
+#ifdef MOTOR_FAST_IO
+  return (*__rev_in & __rev_mask) ? HIGH : LOW;
+#else
+  return digitalRead(__limit_rev);
+#endif
+}
+
+// ------------------------------------
+// Poll for pulses since the last call
+// Never waits, returns the number of new pulses which may be 0.
+// A pulse is counted at the falling edge at the end of the pulse.
+int Arduino_Motor::__poll_pulses() {
+  long count;
+  long delta;
+  int level;
+  unsigned long gap;
+#ifdef MOTOR_STATS
+  unsigned long now;
+
+  now = micros();
+  __stats.polls++;
+  if (now - __stats_poll > __stats.max_gap) __stats.max_gap = now - __stats_poll;
+  __stats_poll = now;
+#endif
+
+  if (__isr_mode) {
+    noInterrupts();
+    count = __isr_count;
+    interrupts();
+    delta = count - __isr_last;
+    __isr_last = count;
+    __track(delta);
+    if (delta < 0) delta = -delta;
+  } else {
+    level = __read_sensor();
+    delta = (__sensor_level && !level) ? 1 : 0;
+    __sensor_level = level;
+    __track(delta);
+  }
+#ifdef MOTOR_STATS
+  __stats.pulses += delta;
+#endif
+  gap = micros() - __last_poll;
+  __last_poll += gap;
+  if (!__isr_mode && gap > __stall_limit() / 2) {
+    // Away too long to have seen every pulse, time the next pulse and
+    // any stall from here
+    __last_pulse = __last_poll;
+  } else if (delta > 0) {
+    __learn_interval((int)delta);
+  }
+  return (int)delta;
+}
+
+// ------------------------------------
+// Learn the pulse interval
+// The interval times the PWM is roughly constant for a given motor and
+// load so one learnt value serves every speed.
+void Arduino_Motor::__learn_interval(int pulses) {
+  unsigned long now, sample;
+
+  now = micros();
+#ifdef MOTOR_STATS
+  // Only once a previous pulse of this operation has been seen
+  if (__stats.pulses > pulses) {
+    sample = (now - __last_pulse) / pulses;
+    if (sample < __stats.interval_min) __stats.interval_min = sample;
+    if (sample > __stats.interval_max) __stats.interval_max = sample;
+    __stats.interval_sum += sample;
+    __stats.intervals++;
+  }
+#endif
+  // Measured speed, starting again from rest
+  if (now - __last_pulse < SPEED_GAP) {
+    sample = (now - __last_pulse) / pulses;
+    if (__interval == 0)
+      __interval = sample;
+    else
+      __interval = __interval - (__interval >> 2) + (sample >> 2);
+  } else {
+    __interval = 0;
+  }
+  // Pulses are slow while speeding up
+  if (__pwm_out > 0 && now - __speed_up > (unsigned long)__stall_start * 1000) {
+    sample = ((now - __last_pulse) / pulses) * __pwm_out;
+    // Follow a motor that slows down gradually but not one that is stalling
+    if (__stall_k > 0) sample = min(sample, 2 * __stall_k);
+    if (__stall_k == 0)
+      __stall_k = sample;
+    else if (sample > __stall_k)
+      __stall_k += (sample - __stall_k) >> 3;
+    else
+      __stall_k -= (__stall_k - sample) >> 3;
+  }
+  __last_pulse = now;
+}
+
+// ------------------------------------
+// Longest time in us without a pulse before the motor is stalled
+// A multiple of the expected interval at the current PWM. Until the motor
+// is up to speed the start time is used. The learnt interval times PWM
+// takes no account of the dead band so near it the motor runs far slower
+// than that says, the interval measured is the least we expect.
+unsigned long Arduino_Motor::__stall_limit() {
+  unsigned long limit, expect;
+
+  limit = (unsigned long)__stall_start * 1000;
+  if (__stall_k > 0 && __pwm_out > 0 && micros() - __speed_up > limit) {
+    expect = max(__stall_k / __pwm_out, __interval);
+    limit = min(expect * __stall_multiple, limit);
+    limit = max(limit, STALL_MIN);
+  }
+  return limit;
+}
+
+// ------------------------------------
+// Test for a stalled motor
+// Polled, only the time loop() was watching the sensor counts, see
+// __poll_pulses().
+bool Arduino_Motor::__stalled() {
+  if (__pwm_out == 0) return false;
+  return micros() - __last_pulse > __stall_limit();
+}
+
+// ------------------------------------
+// Keep the position up to date
+// A quadrature count is signed, otherwise pulses are taken to be in the
+// direction we last drove which includes any coast after stopping.
+void Arduino_Motor::__track(long delta) {
+  long take;
+
+  // Pulses taking up backlash do not move the output
+  if (__lash_left > 0 && delta != 0) {
+    take = min(abs(delta), (long)__lash_left);
+    __lash_left -= (int)take;
+    delta = (delta < 0) ? delta + take : delta - take;
+  }
+  if (__isr_mode && __sensor_b != -1)
+    __position += delta;
+  else if (__drive_dir == PLUS)
+    __position += delta;
+  else
+    __position -= delta;
+}
+
+// ------------------------------------
+// Discard pulses counted while we were not looking
+// They still count towards the position.
+void Arduino_Motor::__sync_pulses() {
+  long count;
+
+  if (__isr_mode) {
+    noInterrupts();
+    count = __isr_count;
+    interrupts();
+    __track(count - __isr_last);
+    __isr_last = count;
+  } else {
+    __sensor_level = __read_sensor();
+    __last_poll = micros();
+  }
+}
+
+// ------------------------------------
+// Sensor interrupt
+void Arduino_Motor::__isr() {
+  if (__sensor_b == -1 || __read_sensor_b()) {
+    __isr_count++;
+  } else {
+    __isr_count--;
+  }
+}
+
+void Arduino_Motor::__isr_0() { __isr_instance[0]->__isr(); }
+void Arduino_Motor::__isr_1() { __isr_instance[1]->__isr(); }
+void Arduino_Motor::__isr_2() { __isr_instance[2]->__isr(); }
+void Arduino_Motor::__isr_3() { __isr_instance[3]->__isr(); }
+
+// ------------------------------------
+// CRC-8 of a calibration record, polynomial 0x07
+byte Arduino_Motor::__crc8(byte *data, int len) {
+  byte crc;
+  int i, bit;
+
+  crc = 0;
+  for (i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (bit = 0; bit < 8; bit++) {
+      if (crc & 0x80)
+        crc = (byte)((crc << 1) ^ 0x07);
+      else
+        crc = (byte)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// ------------------------------------
+// Set the fixed point conversion factors
+// Both are Q16, the span in centidegrees must fit 16 bits so spans are
+// limited to 655 degrees. The conversions multiply the whole and fraction
+// parts separately so any pulse count an int holds stays inside 32 bits.
+void Arduino_Motor::__set_scale() {
+  unsigned long cdeg_span;
+
+  cdeg_span = (unsigned long)__span * 100;
+  __cdeg_per_pulse = ((cdeg_span << 16) + (unsigned long)__num_pulses / 2) / (unsigned long)__num_pulses;
+  __pulses_per_cdeg = (((unsigned long)__num_pulses << 16) + cdeg_span / 2) / cdeg_span;
+}
+
+// ------------------------------------
+// Multiply by a Q16 factor, rounded to nearest
+// x must be under 65536 for the fraction part to stay inside 32 bits.
+unsigned long Arduino_Motor::__q16_mul(unsigned long x, unsigned long q16) {
+  return x * (q16 >> 16) + ((x * (q16 & 0xFFFFUL) + 0x8000UL) >> 16);
+}
+
+// ------------------------------------
+// Convert pulses from home to centidegrees, rounded to nearest
+long Arduino_Motor::__pulses_to_cdeg(long pulses) {
+  unsigned long p, limit;
+  long cdeg;
+
+  p = (pulses < 0) ? -pulses : pulses;
+  // Positions are never far outside the span, 1.5 times the largest
+  // pulse count is still under 65536
+  limit = (unsigned long)__num_pulses + (unsigned long)__num_pulses / 2;
+  if (p > limit) p = limit;
+  cdeg = (long)__q16_mul(p, __cdeg_per_pulse);
+  return (pulses < 0) ? -cdeg : cdeg;
+}
+
+// ------------------------------------
+// Convert centidegrees to pulses from home, rounded to nearest
+long Arduino_Motor::__cdeg_to_pulses(long cdeg) {
+  unsigned long c;
+  long pulses;
+
+  c = (cdeg < 0) ? -cdeg : cdeg;
+  if (c > 0xFFFFUL) c = 0xFFFFUL;
+  pulses = (long)__q16_mul(c, __pulses_per_cdeg);
+  return (cdeg < 0) ? -pulses : pulses;
+}
+
+// ------------------------------------
+// Convert centidegrees to degrees, rounded to nearest
+int Arduino_Motor::__cdeg_to_deg(long cdeg) {
+  if (cdeg < 0) return (int)((cdeg - 50) / 100);
+  return (int)((cdeg + 50) / 100);
+}
+
+// ------------------------------------
+// Calculate current position and dispatch status event
+// Events that do not pass the event policy are counted and dropped.
+// A final event is always sent.
+void Arduino_Motor::__do_event(bool final) {
+  long cdeg;
+  unsigned long now;
+
+  cdeg = __pulses_to_cdeg(__position);
+  if (!final) {
+    // Only on a change of position, the first event always goes
+    if (__event_cdeg != EVENT_NONE) {
+      if (__event_change == EVENT_DEGREE && __cdeg_to_deg(cdeg) == __cdeg_to_deg(__event_cdeg)) {
+        __events_suppressed++;
+        return;
+      }
+      if (__event_change == EVENT_CDEG && cdeg == __event_cdeg) {
+        __events_suppressed++;
+        return;
+      }
+    }
+    // Rate limit
+    if (__event_interval > 0 || __event_rate > 0) {
+      now = millis();
+      if (__event_interval > 0 && now - __event_time < __event_interval) {
+        __events_suppressed++;
+        return;
+      }
+      if (__event_rate > 0) {
+        if (now - __event_window >= 1000) {
+          __event_window = now;
+          __event_window_cnt = 0;
+        }
+        if (__event_window_cnt >= __event_rate) {
+          __events_suppressed++;
+          return;
+        }
+      }
+    }
+  }
+  __event_cdeg = cdeg;
+  if (__event_interval > 0 || __event_rate > 0) {
+    __event_time = millis();
+    __event_window_cnt++;
+  }
+#ifdef MOTOR_STATS
+  now = micros();
+#endif
+  if (__event_cdeg_func) __event_cdeg_func(cdeg);
+  __event_func(__cdeg_to_deg(cdeg));
+#ifdef MOTOR_STATS
+  __stats.callback_time += micros() - now;
+#endif
+}
+
+#ifdef MOTOR_STATS
+// ------------------------------------
+// Complete the statistics for the operation
+void Arduino_Motor::__stats_end() {
+  __stats.duration = millis() - __stats_start;
+  if (__stats.intervals == 0) __stats.interval_min = 0;
+  if (__op == OP_MOVE) __stats.error = __pulses_to_cdeg(__move_target - __position);
+}
+#endif
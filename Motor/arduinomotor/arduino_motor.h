@@ -1,71 +1,386 @@
-/*
-  arduino_motor.h - Library for managing a DC motor with encoder
-*/
-
-#ifndef arduino_motor_h
-#define arduino_motor_h
-
-#include "Arduino.h"
-
-class Arduino_Motor
-{
-  public:
-    Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd, int limit_rev, int span);
-    Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd_rev, int span);
-
-	// Public method prototypes
-  void set_speed(int new_speed);
-  void set_backoff_speed(int new_speed);
-	int calibrate();
-  int calibrate_fwd();
-  int calibrate_rev();
-  void set_cal(int num_pulses);
-  bool move_to_home();
-  bool move_to_position(int deg);
-  void nudge_fwd();
-  void nudge_rev();
- 
-  private:
-  // Pin allocations
-  int __direction;
-  int __pwm;
-  int __sensor;
-  int __limit_fwd;
-  int __limit_rev;
-  int __limit_fwd_rev;
-  int __span;
-  void (*__event_func)(int position);
-  
-  // Speed
-  int __speed;
-  int __backoff_speed;
-
-  // Instance vars
-  volatile int __type;
-  volatile bool __calibrated;
-  volatile int __pulse_cnt;
-  volatile int __num_pulses;
-  volatile int __degrees;
-  volatile float __pulses_per_degree;
-  volatile bool __abort;
-  
-	// Private method prototypes
-	void __forward(int fwd_speed);
-  void __reverse(int rev_speed);
-  void __stop();
-  bool __test_fwd_limit();
-  bool __test_not_fwd_limit();
-  bool __wait_fwd_limit();
-  bool __wait_not_fwd_limit();
-  
-  bool __test_rev_limit();
-  bool __test_not_rev_limit();
-  bool __wait_rev_limit();
-  bool __wait_not_rev_limit();
-
-  bool __read_sensor();
-
-  void __do_event(int current_degrees, int deg, int num_pulses, int pulses_to_move);
-};
-
-#endif
+/*
+  arduino_motor.h - Library for managing a DC motor with encoder
+*/
+
+#ifndef arduino_motor_h
+#define arduino_motor_h
+
+#include "Arduino.h"
+
+// Number of motors that can count sensor pulses by interrupt
+#define MOTOR_MAX_ISR 4
+// Number of entries in the move acceleration table
+#define MOTOR_RAMP_LEN 32
+// Bytes of EEPROM used by a calibration record
+#define MOTOR_EE_SIZE (13 + 3 * MOTOR_VMAP_LEN)
+// Number of queued tracking targets
+#define MOTOR_TRACK_LEN 4
+// Number of points in the PWM to speed map
+#define MOTOR_VMAP_LEN 4
+
+// Uncomment to collect statistics for each operation, see stats()
+//#define MOTOR_STATS
+
+// Bytes of RAM used by an instance on AVR, see README.md
+#ifdef MOTOR_STATS
+#define MOTOR_FOOTPRINT 393
+#else
+#define MOTOR_FOOTPRINT 343
+#endif
+
+// Read input pins straight from the port registers on AVR
+#if defined(__AVR__)
+#define MOTOR_FAST_IO
+#endif
+
+// Faults returned by fault()
+enum {
+  MOTOR_FAULT_NONE,
+  MOTOR_FAULT_STALL,        // Pulses stopped while driving
+  MOTOR_FAULT_WRONG_LIMIT,  // Hit the opposite limit switch
+  MOTOR_FAULT_TIMEOUT,      // Limit switch not reached or released in time
+  MOTOR_FAULT_POSITION,     // Home switch not where the stored position says
+  MOTOR_FAULT_ABORT,        // Aborted by the caller
+  MOTOR_FAULT_COUNT         // No pulses counted between the limit switches
+};
+
+// Event policies for set_event_policy()
+enum {
+  EVENT_ALL,        // Every pulse
+  EVENT_DEGREE,     // On a change of degree
+  EVENT_CDEG        // On a change of centidegree
+};
+
+#ifdef MOTOR_STATS
+// Statistics for the last operation returned by stats()
+struct Motor_Stats {
+  unsigned long duration;       // Time taken in ms
+  long pulses;                  // Pulses counted
+  unsigned long polls;          // Times the sensor was sampled
+  unsigned long interval_min;   // Shortest pulse interval in us
+  unsigned long interval_max;   // Longest pulse interval in us
+  unsigned long interval_sum;   // Sum of intervals for the average
+  unsigned long intervals;      // Number of intervals summed
+  unsigned long max_gap;        // Longest gap between sensor samples in us
+  unsigned long callback_time;  // Time spent in event callbacks in us
+  int nudges;                   // Moves off a limit switch
+  long error;                   // Move target less final position in cdeg
+};
+#endif
+
+// Motor states returned by state()
+enum {
+  MOTOR_IDLE,       // Nothing started
+  MOTOR_SEEK,       // Running to a limit switch
+  MOTOR_BACKOFF,    // Backing off until the limit switch releases
+  MOTOR_COUNT,      // Counting pulses to the opposite limit switch
+  MOTOR_UNCOUNT,    // Counting pulses backing off the opposite limit switch
+  MOTOR_MOVE,       // Moving to a position
+  MOTOR_SERVO,      // Moving to a position under closed loop control
+  MOTOR_TRACK,      // Following queued tracking targets
+  MOTOR_NUDGE,      // Moving off a limit switch at the end of a move
+  MOTOR_PAUSE,      // Waiting for the motor to settle after a stop
+  MOTOR_DONE,       // Last operation completed
+  MOTOR_FAILED      // Last operation failed or was aborted
+};
+
+class Arduino_Motor
+{
+  public:
+    Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd, int limit_rev, int span);
+    Arduino_Motor(int t, void (*func)(int position), int dir, int pwm, int sensor, int limit_fwd_rev, int span);
+    ~Arduino_Motor();
+
+	// Public method prototypes
+  void set_speed(int new_speed);
+  void set_backoff_speed(int new_speed);
+  void set_seek_speed(int fast_speed, int slow_deg);
+  void set_ramp(int start_duty, int accel, int jerk);
+  void set_closed_loop(bool enable);
+  void set_pid(int kp, int ki, int kd);
+  void set_deadband(int pulses);
+  void set_pwm_limit(int min_duty, int max_duty);
+	int calibrate();
+  int calibrate_fwd();
+  int calibrate_rev();
+  bool set_cal(int num_pulses);
+  bool save_cal(int addr);
+  bool load_cal(int addr);
+  bool restore_cal(int addr, int tolerance);
+  void set_backlash_comp(bool enable);
+  void set_backlash(int pulses);
+  int backlash();
+  bool move_to_home();
+  bool move_to_position(int deg);
+  bool move_to_position_cdeg(long cdeg);
+  int position();
+  long position_cdeg();
+  void set_event_cdeg(void (*func)(long cdeg));
+  void set_event_policy(int change, unsigned int min_interval, unsigned int max_per_sec);
+  unsigned long events_suppressed();
+  void nudge_fwd();
+  void nudge_rev();
+  void set_soft_limits(int margin, int decel);
+  unsigned long nudge_count();
+  bool use_interrupts(int sensor_b = -1);
+  long encoder_count();
+
+  // Non-blocking operations, call update() until it returns false
+  bool start_calibrate();
+  bool start_home();
+  bool start_verify_home(int tolerance);
+  bool start_move_to_position(int deg);
+  bool start_move_to_position_cdeg(long cdeg, int scale = 256);
+  unsigned long move_estimate(long cdeg);
+  bool set_velocity(long cdeg_per_sec);
+  long speed_cdeg();
+  bool update();
+  void abort();
+  int state();
+  bool busy();
+  int fault();
+
+  // Continuous tracking
+  bool start_tracking();
+  bool track_target(long cdeg, unsigned long at_ms, bool replace = false);
+  void stop_tracking();
+  long tracking_error();
+  long tracking_error_max();
+  long tracking_error_mean();
+  void set_stall(int multiple, unsigned int start_ms);
+  void set_settle(unsigned int window_ms, unsigned int max_ms);
+  unsigned long settle_time();
+#ifdef MOTOR_STATS
+  const Motor_Stats &stats();
+  void print_stats(Print &out);
+#endif
+ 
+  private:
+  // Pin allocations
+  int __direction;
+  int __pwm;
+  int __sensor;
+  int __limit_fwd;
+  int __limit_rev;
+  int __limit_fwd_rev;
+  int __span;
+#ifdef MOTOR_FAST_IO
+  // Port input registers and bit masks for the input pins
+  volatile uint8_t *__sensor_in;
+  uint8_t __sensor_mask;
+  volatile uint8_t *__sensor_b_in;
+  uint8_t __sensor_b_mask;
+  volatile uint8_t *__fwd_in;
+  uint8_t __fwd_mask;
+  volatile uint8_t *__rev_in;
+  uint8_t __rev_mask;
+#endif
+  void (*__event_func)(int position);
+  void (*__event_cdeg_func)(long cdeg);
+
+  // Event policy
+  byte __event_change;
+  unsigned int __event_interval;
+  unsigned int __event_rate;
+  long __event_cdeg;
+  unsigned long __event_time;
+  unsigned long __event_window;
+  unsigned int __event_window_cnt;
+  unsigned long __events_suppressed;
+  
+  // Speed
+  int __speed;
+  int __backoff_speed;
+  int __fast_speed;
+  int __seek_slow;
+
+  // Move acceleration profile
+  int __ramp_start;
+  int __ramp_accel;
+  int __ramp_jerk;
+  byte __ramp[MOTOR_RAMP_LEN];
+  int __ramp_len;
+  int __ramp_shift;
+
+  // Instance vars
+  byte __type;
+  bool __calibrated;
+  int __pulse_cnt;
+  int __num_pulses;
+  // Q16 conversion factors between pulses and centidegrees
+  unsigned long __cdeg_per_pulse;
+  unsigned long __pulses_per_cdeg;
+  // Set by abort() which may be called from an interrupt
+  volatile bool __abort;
+
+  // Interrupt driven pulse counting
+  bool __isr_mode;
+  int __sensor_b;
+  volatile long __isr_count;
+  long __isr_last;
+  static Arduino_Motor *__isr_instance[MOTOR_MAX_ISR];
+  byte __sensor_level;
+
+  // State machine
+  byte __op;
+  byte __phase;
+  byte __next_phase;
+  byte __seek_dir;
+  byte __seek_stage;
+  unsigned long __phase_start;
+  unsigned long __settle_start;
+  byte __fault;
+
+  // Stall detection
+  int __pwm_out;
+  unsigned long __last_pulse;
+  unsigned long __last_poll;
+  unsigned long __speed_up;
+  unsigned long __stall_k;
+  // Measured speed and PWM to pulses/s map built by calibration
+  unsigned long __interval;
+  int __vmap_pwm[MOTOR_VMAP_LEN];
+  long __vmap_pps[MOTOR_VMAP_LEN];
+  int __vmap_len;
+  int __vmap_step;
+  bool __vmap_measuring;
+  unsigned long __vmap_time;
+  int __vmap_mark;
+  unsigned long __vmap_mark_time;
+  int __stall_multiple;
+  unsigned int __stall_start;
+  // Settle detection
+  unsigned int __settle_window;
+  unsigned int __settle_max;
+  unsigned long __settle_time;
+  // Calibration runs
+  int __cal_count;
+  int __cal_fwd;
+  int __cal_rev;
+  int __cal_lash;
+  // Current move
+  byte __move_dir;
+  int __move_pulses;
+  int __pulses_to_move;
+  int __move_pwm;
+  int __move_scale;
+  int __verify_tolerance;
+
+  // Soft limits in pulses inside the limit switches
+  int __soft_margin;
+  int __soft_decel;
+  unsigned long __nudge_count;
+
+  // Backlash compensation
+  bool __backlash_comp;
+  int __backlash;
+  int __lash_left;
+  long __move_target;
+
+  // Position in pulses from home
+  long __position;
+  byte __drive_dir;
+
+  // Closed loop control
+  bool __closed_loop;
+  int __pid_kp;
+  int __pid_ki;
+  int __pid_kd;
+  int __pid_deadband;
+  int __pid_min;
+  int __pid_max;
+  long __pid_e;
+  long __pid_i;
+  unsigned long __pid_time;
+
+  // Tracking target queue and error
+  long __trk_pulses[MOTOR_TRACK_LEN];
+  unsigned long __trk_time[MOTOR_TRACK_LEN];
+  int __trk_head;
+  int __trk_count;
+  long __trk_from;
+  unsigned long __trk_from_time;
+  long __trk_err;
+  long __trk_err_max;
+  unsigned long __trk_err_sum;
+  unsigned long __trk_err_n;
+
+#ifdef MOTOR_STATS
+  // Statistics for the current operation
+  Motor_Stats __stats;
+  unsigned long __stats_start;
+  unsigned long __stats_poll;
+#endif
+  
+	// Private method prototypes
+  void __init_vars();
+  void __map_pins();
+  int __read_sensor();
+  int __read_sensor_b();
+  int __read_fwd_limit();
+  int __read_rev_limit();
+  bool __start(int op);
+  bool __run();
+  void __enter(int phase);
+  long __soft_clamp(long pulses);
+  bool __in_decel_zone(int dir);
+  long __seek_distance();
+  void __pause(int next_phase);
+  void __fail(int fault);
+  void __end_move();
+  void __finish();
+
+  void __build_ramp();
+  int __ramp_pwm(int pulses);
+  int __move_speed();
+  void __ramp_speed();
+  void __servo();
+  void __track_step(unsigned long now);
+  long __track_setpoint(unsigned long now, long *velocity);
+  long __ff_pwm(long velocity);
+  long __pwm_to_pps(int pwm);
+  long __pps_to_pwm(long pps);
+  int __vmap_level(int step);
+  void __vmap_sample(unsigned long now);
+  void __vmap_next(unsigned long now);
+  long __pid(long e, long ff);
+  void __pid_hold(long e);
+  void __servo_drive(long out);
+
+  void __drive(int dir, int speed);
+	void __forward(int fwd_speed);
+  void __reverse(int rev_speed);
+  void __stop();
+  void __set_pwm(int pwm);
+  bool __test_limit(int dir);
+  bool __limit_ahead(int dir);
+  bool __test_fwd_limit();
+  bool __test_not_fwd_limit();
+  bool __test_rev_limit();
+  bool __test_not_rev_limit();
+
+  int __poll_pulses();
+  void __track(long delta);
+  void __learn_interval(int pulses);
+  unsigned long __stall_limit();
+  bool __stalled();
+  void __sync_pulses();
+  void __isr();
+  static void __isr_0();
+  static void __isr_1();
+  static void __isr_2();
+  static void __isr_3();
+
+  byte __crc8(byte *data, int len);
+  void __set_scale();
+  unsigned long __q16_mul(unsigned long x, unsigned long q16);
+  long __pulses_to_cdeg(long pulses);
+  long __cdeg_to_pulses(long cdeg);
+  int __cdeg_to_deg(long cdeg);
+  void __do_event(bool final);
+#ifdef MOTOR_STATS
+  void __stats_end();
+#endif
+};
+
+#endif
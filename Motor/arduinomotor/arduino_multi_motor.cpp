@@ -0,0 +1,176 @@
+/*
+  arduino_multi_motor.cpp - Library for moving several DC motors together
+*/
+
+#include "arduino_multi_motor.h"
+
+// ==============================================================
+// PUBLIC
+
+#if defined(__AVR__)
+// Catch growth in the RAM used, raise MULTI_FOOTPRINT deliberately
+static_assert(sizeof(Arduino_MultiMotor) <= MULTI_FOOTPRINT, "Arduino_MultiMotor has grown");
+#endif
+
+// Constructor
+// func is called with the position of every axis in centidegrees
+Arduino_MultiMotor::Arduino_MultiMotor(void (*func)(long *cdeg, int num_axes)) {
+  __event_func = func;
+  __num_axes = 0;
+  __min_scale = 64;
+  __state = MOTOR_IDLE;
+}
+
+// ------------------------------------
+// Add an axis
+// The motor must already be calibrated before a move is started.
+bool Arduino_MultiMotor::add(Arduino_Motor *motor) {
+  if (__num_axes >= MULTI_MAX_AXES) return false;
+  __axes[__num_axes++] = motor;
+  return true;
+}
+
+// ------------------------------------
+// Set the least an axis speed is scaled to as a percentage
+// Below this a motor may not turn at all.
+void Arduino_MultiMotor::set_min_scale(int percent) {
+  __min_scale = (int)(((long)percent * 256) / 100);
+}
+
+// ------------------------------------
+// Move all axes to the given positions
+// Blocking
+bool Arduino_MultiMotor::move_to_position(long *cdeg) {
+  if (!start_move_to_position(cdeg)) return false;
+  while (update());
+  return __state == MOTOR_DONE;
+}
+
+// ------------------------------------
+// Start a move of all axes
+// cdeg holds a target per axis in the order they were added. The axis with
+// the longest move runs at its set speed and the others are slowed so all
+// arrive together.
+bool Arduino_MultiMotor::start_move_to_position(long *cdeg) {
+  unsigned long estimate[MULTI_MAX_AXES];
+  unsigned long longest;
+  int scale;
+  int i;
+
+  if (busy() || __num_axes == 0) return false;
+  for (i = 0; i < __num_axes; i++) {
+    if (__axes[i]->busy()) return false;
+  }
+
+  //----------------
+  // Find the longest move
+  longest = 0;
+  for (i = 0; i < __num_axes; i++) {
+    estimate[i] = __axes[i]->move_estimate(cdeg[i]);
+    if (estimate[i] > longest) longest = estimate[i];
+  }
+
+  //----------------
+  // Start every axis scaled to the longest move
+  for (i = 0; i < __num_axes; i++) {
+    scale = 256;
+    if (longest > 0) scale = (int)((estimate[i] << 8) / longest);
+    scale = max(scale, __min_scale);
+    if (!__axes[i]->start_move_to_position_cdeg(cdeg[i], scale)) {
+      // Stop anything we already started
+      while (--i >= 0) __axes[i]->abort();
+      while (__any_busy());
+      __state = MOTOR_FAILED;
+      return false;
+    }
+    __cdeg[i] = __axes[i]->position_cdeg();
+    __deg[i] = __axes[i]->position();
+  }
+  __state = MOTOR_MOVE;
+  return true;
+}
+
+// ------------------------------------
+// Advance all axes
+// Call from loop() as often as possible while a move is running.
+// Returns true while the move is still in progress.
+bool Arduino_MultiMotor::update() {
+  bool running;
+  bool failed;
+  bool changed;
+  int i;
+
+  if (!busy()) return false;
+
+  running = false;
+  failed = false;
+  changed = false;
+  for (i = 0; i < __num_axes; i++) {
+    if (__axes[i]->update()) running = true;
+    if (__axes[i]->state() == MOTOR_FAILED) failed = true;
+    if (__axes[i]->position() != __deg[i]) changed = true;
+  }
+
+  //----------------
+  // One axis failing stops them all
+  if (failed && running) {
+    abort();
+    return true;
+  }
+  // The final event below covers a change on the last pass
+  if (changed && running) __do_event();
+  if (!running) {
+    __state = failed ? MOTOR_FAILED : MOTOR_DONE;
+    __do_event();
+  }
+  return running;
+}
+
+// ------------------------------------
+// Abort the move on all axes
+// Each motor is stopped on its next update()
+void Arduino_MultiMotor::abort() {
+  int i;
+  for (i = 0; i < __num_axes; i++) __axes[i]->abort();
+}
+
+// ------------------------------------
+// Current state, MOTOR_MOVE while running then MOTOR_DONE or MOTOR_FAILED
+int Arduino_MultiMotor::state() {
+  return __state;
+}
+
+// ------------------------------------
+// True while a move is in progress
+bool Arduino_MultiMotor::busy() {
+  return __state == MOTOR_MOVE;
+}
+
+// ==============================================================
+// PRIVATE
+
+// ------------------------------------
+// True while any axis is running
+bool Arduino_MultiMotor::__any_busy() {
+  bool running;
+  int i;
+
+  running = false;
+  for (i = 0; i < __num_axes; i++) {
+    if (__axes[i]->update()) running = true;
+  }
+  return running;
+}
+
+// ------------------------------------
+// Dispatch the position of all axes
+// Sent when any axis changes degree and at the end of the move.
+void Arduino_MultiMotor::__do_event() {
+  int i;
+
+  for (i = 0; i < __num_axes; i++) {
+    __cdeg[i] = __axes[i]->position_cdeg();
+    __deg[i] = __axes[i]->position();
+  }
+  if (__event_func) __event_func(__cdeg, __num_axes);
+}
@@ -0,0 +1,48 @@
+/*
+  arduino_multi_motor.h - Library for moving several DC motors together
+*/
+
+#ifndef arduino_multi_motor_h
+#define arduino_multi_motor_h
+
+#include "Arduino.h"
+#include "arduino_motor.h"
+
+// Maximum number of axes
+#define MULTI_MAX_AXES 4
+// Bytes of RAM used by an instance on AVR, see README.md
+#define MULTI_FOOTPRINT 40
+
+class Arduino_MultiMotor
+{
+  public:
+    Arduino_MultiMotor(void (*func)(long *cdeg, int num_axes));
+
+	// Public method prototypes
+  bool add(Arduino_Motor *motor);
+  void set_min_scale(int percent);
+  bool move_to_position(long *cdeg);
+  bool start_move_to_position(long *cdeg);
+  bool update();
+  void abort();
+  int state();
+  bool busy();
+
+  private:
+  // Axes in the order added
+  Arduino_Motor *__axes[MULTI_MAX_AXES];
+  int __num_axes;
+  void (*__event_func)(long *cdeg, int num_axes);
+
+  // Instance vars
+  int __min_scale;
+  int __state;
+  long __cdeg[MULTI_MAX_AXES];
+  int __deg[MULTI_MAX_AXES];
+
+	// Private method prototypes
+  bool __any_busy();
+  void __do_event();
+};
+
+#endif
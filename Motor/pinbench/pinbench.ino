@@ -0,0 +1,76 @@
+// Time a motor input read through digitalRead() against the cached port
+// register read Arduino_Motor uses on AVR. Runs on the target, prints the
+// time per read in ns to the serial monitor at 115200.
+
+#if !defined(__AVR__)
+#error "The cached register read is only used on AVR"
+#endif
+
+// Sensor and limit switch pins of the azimuth motor in the example sketch
+const int PINS[] = { 30, 24 };
+const long READS = 10000;
+
+volatile byte __sink;
+
+// ------------------------------------
+// Time READS reads of a pin with digitalRead()
+unsigned long time_digital_read(int pin) {
+  unsigned long start;
+  long i;
+
+  start = micros();
+  for (i = 0; i < READS; i++) __sink = digitalRead(pin);
+  return micros() - start;
+}
+
+// ------------------------------------
+// Time READS reads of a pin from its port register, looked up once
+unsigned long time_register_read(int pin) {
+  volatile uint8_t *in;
+  uint8_t mask;
+  unsigned long start;
+  long i;
+
+  in = portInputRegister(digitalPinToPort(pin));
+  mask = digitalPinToBitMask(pin);
+  start = micros();
+  for (i = 0; i < READS; i++) __sink = (*in & mask) ? HIGH : LOW;
+  return micros() - start;
+}
+
+// ------------------------------------
+// Time the loop alone so it can be taken off
+unsigned long time_empty() {
+  unsigned long start;
+  long i;
+
+  start = micros();
+  for (i = 0; i < READS; i++) __sink = LOW;
+  return micros() - start;
+}
+
+void setup() {
+  int i;
+
+  Serial.begin(115200);
+  for (i = 0; i < 2; i++) pinMode(PINS[i], INPUT_PULLUP);
+}
+
+void loop() {
+  unsigned long empty, digital, reg;
+  int i;
+
+  empty = time_empty();
+  for (i = 0; i < 2; i++) {
+    digital = time_digital_read(PINS[i]) - empty;
+    reg = time_register_read(PINS[i]) - empty;
+    Serial.print("Pin ");
+    Serial.print(PINS[i]);
+    Serial.print(": digitalRead ");
+    Serial.print(digital * 1000 / READS);
+    Serial.print(" ns, register ");
+    Serial.print(reg * 1000 / READS);
+    Serial.println(" ns");
+  }
+  delay(2000);
+}
@@ -1,65 +1,507 @@
-/*
-  arduino_udp.cpp - Library for managing a udp connection
-*/
-
-#include "arduino_udp.h"
-
-// ==============================================================
-// PUBLIC
-
-// Constructor
-Arduino_UDP::Arduino_UDP(byte *mac, byte *ip, unsigned int cmd_port, unsigned int evnt_port) {
-
-	_cmd_port = cmd_port;
-	_evnt_port = evnt_port;
-
-	_udp = new EthernetUDP();
-	IPAddress _ip = IPAddress(ip[0], ip[1], ip[2], ip[3]);
-	// Start Ethernet and UDP:
-	Ethernet.begin(mac, _ip);
-  	_udp->begin(_cmd_port);
-}
-
-// Read packet
-bool Arduino_UDP::doRead(char* packet_buffer) {
-	// Read the packet into packetBufffer
-	int packet_size = queryPacket();
-	if (packet_size > 0) {
-		_udp->read(packet_buffer, UDP_TX_PACKET_MAX_SIZE);
-		// Terminate buffer
-		packet_buffer[packet_size] = '\0';
-		return true;
-	}
-	return false;
-}
-
-// Write response
-bool Arduino_UDP::sendResponse(char* reply_buffer) {
-	// Send a reply to the IP address and port that sent us the packet we received
-	_udp->beginPacket(_udp->remoteIP(), _udp->remotePort());
-	_udp->write(reply_buffer);
-	_udp->endPacket();
-	return true;
-}
-
-// Write event
-bool Arduino_UDP::sendEvent(char* evnt_buffer) {
-  // Send an event to the event port of the IP address that sent us the packet we received
-  _udp->beginPacket(_udp->remoteIP(), _evnt_port);
-  _udp->write(evnt_buffer);
-  _udp->endPacket();
-  return true;
-}
-
-// ==============================================================
-// PRIVATE
-
-// Data available?
-int Arduino_UDP::queryPacket() {
-	int packetSize = _udp->parsePacket();
-  //Serial.println(packetSize);
-	  if (packetSize)
-	    return packetSize;
-	   else
-     return 0;
-}
+/*
+  arduino_udp.cpp - Library for managing a udp connection
+*/
+
+#include "arduino_udp.h"
+
+// ==============================================================
+// PUBLIC
+
+#if defined(__AVR__)
+// Catch growth in the RAM used, raise UDP_FOOTPRINT deliberately
+static_assert(sizeof(Arduino_UDP) <= sizeof(EthernetUDP) + UDP_FOOTPRINT, "Arduino_UDP has grown");
+#endif
+
+// Constructor
+Arduino_UDP::Arduino_UDP(byte *mac, byte *ip, unsigned int cmd_port, unsigned int evnt_port) {
+
+	_cmd_port = cmd_port;
+	_evnt_port = evnt_port;
+	initVars();
+	begin(mac, ip);
+}
+
+// Constructor for static instances, call begin() from setup()
+Arduino_UDP::Arduino_UDP(unsigned int cmd_port, unsigned int evnt_port) {
+
+	_cmd_port = cmd_port;
+	_evnt_port = evnt_port;
+	initVars();
+}
+
+// Start Ethernet and UDP
+void Arduino_UDP::begin(byte *mac, byte *ip) {
+	IPAddress _ip = IPAddress(ip[0], ip[1], ip[2], ip[3]);
+	Ethernet.begin(mac, _ip);
+  	_udp.begin(_cmd_port);
+}
+
+// Read packet
+// The buffer must hold UDP_TX_PACKET_MAX_SIZE + 1 bytes, longer packets are truncated
+bool Arduino_UDP::doRead(char* packet_buffer) {
+	return doRead(packet_buffer, UDP_TX_PACKET_MAX_SIZE + 1) > 0;
+}
+
+// Read packet into a buffer of the given capacity
+// Reads at most capacity - 1 bytes and terminates the buffer. Returns the
+// length read or 0 if no packet is waiting. Any excess is discarded.
+int Arduino_UDP::doRead(char* packet_buffer, int capacity) {
+	int length;
+
+	if (capacity < 1 || beginRead() == 0)
+		return 0;
+	length = readChunk(packet_buffer, capacity - 1);
+	// Terminate buffer
+	packet_buffer[length] = '\0';
+	return length;
+}
+
+// Start reading the next packet
+// Returns its size or 0 if no packet is waiting. The packet is then read
+// with readChunk() straight from the Ethernet chip and whatever is not
+// read is discarded by the next beginRead().
+int Arduino_UDP::beginRead() {
+	return queryPacket();
+}
+
+// Read up to capacity bytes of the current packet, no terminator
+// Returns the number of bytes read.
+int Arduino_UDP::readChunk(char* buffer, int capacity) {
+	int length;
+
+	if (capacity <= 0)
+		return 0;
+	length = _udp.read(buffer, capacity);
+	if (length < 0)
+		return 0;
+	return length;
+}
+
+// Bytes of the current packet not yet read
+int Arduino_UDP::remaining() {
+	return _udp.available();
+}
+
+// Address and port the current packet came from
+IPAddress Arduino_UDP::remoteIP() {
+	return _udp.remoteIP();
+}
+
+unsigned int Arduino_UDP::remotePort() {
+	return _udp.remotePort();
+}
+
+// Write response
+bool Arduino_UDP::sendResponse(char* reply_buffer) {
+	return sendResponse(reply_buffer, strlen(reply_buffer));
+}
+
+// Write response of the given length
+// The buffer can be the one the request was read into.
+bool Arduino_UDP::sendResponse(const char* reply_buffer, int length) {
+	if (_txPolicy != UDP_TX_DIRECT)
+		return queueTx(false, reply_buffer, length);
+	// Send a reply to the IP address and port that sent us the packet we received
+	return writeResponse(_udp.remoteIP(), _udp.remotePort(), reply_buffer, length);
+}
+
+// Write event
+bool Arduino_UDP::sendEvent(char* evnt_buffer) {
+  return sendEvent(evnt_buffer, strlen(evnt_buffer));
+}
+
+// Write event of the given length
+// When batching, a non-zero key replaces any unsent event with the same
+// key, so only the latest position of an axis goes out.
+bool Arduino_UDP::sendEvent(const char* evnt_buffer, int length, byte key) {
+  int i;
+
+  _eventsSubmitted++;
+  if (_batchInterval == 0)
+    return postEvent(evnt_buffer, length);
+
+  if (key != 0)
+    dropEvent(key);
+  // Too long to stage, what is staged goes first to keep the order
+  if (length > UDP_EVENT_BATCH) {
+    flushEvents();
+    return postEvent(evnt_buffer, length);
+  }
+  if (_evntLen + length > UDP_EVENT_BATCH)
+    flushEvents();
+  if (_evntLen == 0)
+    _evntTime = millis();
+  if (key != 0) {
+    for (i = 0; i < UDP_EVENT_KEYS && _evntKey[i] != 0; i++);
+    if (i < UDP_EVENT_KEYS) {
+      _evntKey[i] = key;
+      _evntOff[i] = _evntLen;
+      _evntSize[i] = length;
+    }
+  }
+  memcpy(_evntBuf + _evntLen, evnt_buffer, length);
+  _evntLen += length;
+  return true;
+}
+
+// Batch events into one datagram
+// Events are staged and sent together when the staging buffer fills,
+// interval_ms after the first one, or on flushEvents(). They are simply
+// concatenated so text events should carry their own terminator.
+// An interval of 0 sends each event as it comes.
+void Arduino_UDP::setEventBatch(unsigned int interval_ms) {
+  flushEvents();
+  _batchInterval = interval_ms;
+}
+
+// Send any staged events now
+bool Arduino_UDP::flushEvents() {
+  int i;
+  bool ok;
+
+  if (_evntLen == 0)
+    return true;
+  ok = postEvent(_evntBuf, _evntLen);
+  _evntLen = 0;
+  for (i = 0; i < UDP_EVENT_KEYS; i++)
+    _evntKey[i] = 0;
+  return ok;
+}
+
+// Call from loop() to send staged events once the interval is up and
+// drain the transmit queue
+// At least one queued datagram is sent per call, then more until
+// budget_us has passed. A budget of 0 empties the queue.
+void Arduino_UDP::service(unsigned int budget_us) {
+  unsigned long start;
+
+  if (_evntLen > 0 && millis() - _evntTime >= _batchInterval)
+    flushEvents();
+  start = micros();
+  while (_txCount > 0) {
+    sendTx();
+    if (budget_us > 0 && micros() - start >= budget_us)
+      break;
+  }
+}
+
+// Queue replies and events instead of sending them at once
+// With a queue sendResponse() and sendEvent() only copy the datagram,
+// the SPI transfer to the Ethernet chip happens in service(). Replies
+// go to the sender of the request even if other packets arrive first.
+// Events are sent to the subscribers at the time they leave the queue.
+// UDP_TX_DIRECT sends anything still queued and turns the queue off.
+void Arduino_UDP::setTxQueue(byte policy) {
+  if (policy == UDP_TX_DIRECT)
+    service(0);
+  _txPolicy = policy;
+}
+
+// Datagrams waiting in the transmit queue
+int Arduino_UDP::txPending() {
+  return _txCount;
+}
+
+// Most bytes the transmit queue has held
+int Arduino_UDP::txPeak() {
+  return _txPeak;
+}
+
+// Datagrams dropped because the transmit queue was full
+unsigned long Arduino_UDP::txDropped() {
+  return _txDropped;
+}
+
+// Events passed to sendEvent()
+unsigned long Arduino_UDP::eventsSubmitted() {
+  return _eventsSubmitted;
+}
+
+// Event datagrams actually sent
+unsigned long Arduino_UDP::eventDatagrams() {
+  return _eventDatagrams;
+}
+
+// Subscribe to events
+// Events go to every subscriber on its own port until the lease runs
+// out, subscribe again to renew it. A lease of 0 never runs out. Until
+// there is a subscriber events go to the sender of the last packet.
+// Returns false if the table is full.
+bool Arduino_UDP::subscribe(IPAddress ip, unsigned int port, unsigned long lease_ms) {
+  int i;
+
+  expireSubscribers();
+  i = findSubscriber(ip, port);
+  if (i < 0) {
+    for (i = 0; i < UDP_SUBSCRIBERS && _subUsed[i]; i++);
+    if (i >= UDP_SUBSCRIBERS)
+      return false;
+    _subUsed[i] = true;
+    _subIp[i][0] = ip[0];
+    _subIp[i][1] = ip[1];
+    _subIp[i][2] = ip[2];
+    _subIp[i][3] = ip[3];
+    _subPort[i] = port;
+    _subFailures[i] = 0;
+  }
+  // 0 marks a lease that never runs out
+  _subExpires[i] = 0;
+  if (lease_ms > 0)
+    _subExpires[i] = (millis() + lease_ms) | 1;
+  return true;
+}
+
+// Stop sending events to a subscriber
+bool Arduino_UDP::unsubscribe(IPAddress ip, unsigned int port) {
+  int i;
+
+  i = findSubscriber(ip, port);
+  if (i < 0)
+    return false;
+  _subUsed[i] = false;
+  return true;
+}
+
+// Number of current subscribers
+int Arduino_UDP::subscribers() {
+  int i, n;
+
+  expireSubscribers();
+  n = 0;
+  for (i = 0; i < UDP_SUBSCRIBERS; i++) {
+    if (_subUsed[i])
+      n++;
+  }
+  return n;
+}
+
+// Event datagrams a subscriber has failed to send
+unsigned int Arduino_UDP::sendFailures(IPAddress ip, unsigned int port) {
+  int i;
+
+  i = findSubscriber(ip, port);
+  if (i < 0)
+    return 0;
+  return _subFailures[i];
+}
+
+// ==============================================================
+// PRIVATE
+
+// Initialise instance vars
+void Arduino_UDP::initVars() {
+	int i;
+
+	_batchInterval = 0;
+	_evntLen = 0;
+	_evntTime = 0;
+	for (i = 0; i < UDP_EVENT_KEYS; i++)
+		_evntKey[i] = 0;
+	_eventsSubmitted = 0;
+	_eventDatagrams = 0;
+	for (i = 0; i < UDP_SUBSCRIBERS; i++)
+		_subUsed[i] = false;
+	_txPolicy = UDP_TX_DIRECT;
+	_txHead = 0;
+	_txTail = 0;
+	_txCount = 0;
+	_txBytes = 0;
+	_txPeak = 0;
+	_txDropped = 0;
+}
+
+// Send an event now or queue it
+bool Arduino_UDP::postEvent(const char* evnt_buffer, int length) {
+	if (_txPolicy != UDP_TX_DIRECT)
+		return queueTx(true, evnt_buffer, length);
+	return writeEvent(evnt_buffer, length);
+}
+
+// Send an event datagram to every subscriber
+bool Arduino_UDP::writeEvent(const char* evnt_buffer, int length) {
+  int i;
+  bool ok, sent;
+
+  expireSubscribers();
+  ok = true;
+  sent = false;
+  for (i = 0; i < UDP_SUBSCRIBERS; i++) {
+    if (!_subUsed[i])
+      continue;
+    sent = true;
+    _eventDatagrams++;
+    _udp.beginPacket(IPAddress(_subIp[i][0], _subIp[i][1], _subIp[i][2], _subIp[i][3]), _subPort[i]);
+    _udp.write((const uint8_t*)evnt_buffer, length);
+    if (_udp.endPacket() != 1) {
+      _subFailures[i]++;
+      ok = false;
+    }
+  }
+  if (sent)
+    return ok;
+
+  // Send an event to the event port of the IP address that sent us the packet we received
+  _eventDatagrams++;
+  _udp.beginPacket(_udp.remoteIP(), _evnt_port);
+  _udp.write((const uint8_t*)evnt_buffer, length);
+  return _udp.endPacket() == 1;
+}
+
+// Send a reply datagram
+bool Arduino_UDP::writeResponse(IPAddress ip, unsigned int port, const char* reply_buffer, int length) {
+	_udp.beginPacket(ip, port);
+	_udp.write((const uint8_t*)reply_buffer, length);
+	return _udp.endPacket() == 1;
+}
+
+// Copy a datagram into the transmit queue
+// Each record is a length byte, a kind byte and for a reply the address
+// and port it goes to, then the data. Records never wrap, a length of
+// 0xFF marks the unused end of the buffer when the next one starts at 0.
+bool Arduino_UDP::queueTx(bool event, const char* buffer, int length) {
+	int header, at;
+	IPAddress ip;
+	unsigned int port;
+
+	header = event ? 2 : 8;
+	if (length <= 0)
+		return true;
+	at = -1;
+	if (header + length <= UDP_TX_QUEUE && length < 0xFF) {
+		at = txSpace(header + length);
+		while (at < 0 && _txPolicy == UDP_DROP_OLDEST && _txCount > 0) {
+			dropTx();
+			_txDropped++;
+			at = txSpace(header + length);
+		}
+	}
+	if (at < 0) {
+		_txDropped++;
+		return false;
+	}
+
+	if (at < _txTail && _txTail < UDP_TX_QUEUE)
+		_txBuf[_txTail] = 0xFF;
+	_txBuf[at] = length;
+	_txBuf[at + 1] = event;
+	if (!event) {
+		ip = _udp.remoteIP();
+		port = _udp.remotePort();
+		_txBuf[at + 2] = ip[0];
+		_txBuf[at + 3] = ip[1];
+		_txBuf[at + 4] = ip[2];
+		_txBuf[at + 5] = ip[3];
+		_txBuf[at + 6] = port & 0xFF;
+		_txBuf[at + 7] = port >> 8;
+	}
+	memcpy(_txBuf + at + header, buffer, length);
+	_txTail = at + header + length;
+	_txCount++;
+	_txBytes += header + length;
+	if (_txBytes > _txPeak)
+		_txPeak = _txBytes;
+	return true;
+}
+
+// Where a record of size bytes fits in the transmit queue or -1
+int Arduino_UDP::txSpace(int size) {
+	if (_txCount == 0) {
+		_txHead = 0;
+		_txTail = 0;
+		return 0;
+	}
+	if (_txTail > _txHead) {
+		if (UDP_TX_QUEUE - _txTail >= size)
+			return _txTail;
+		if (_txHead >= size)
+			return 0;
+		return -1;
+	}
+	if (_txHead - _txTail >= size)
+		return _txTail;
+	return -1;
+}
+
+// Send the oldest queued datagram
+bool Arduino_UDP::sendTx() {
+	byte *record;
+	bool ok;
+
+	if (_txHead >= UDP_TX_QUEUE || _txBuf[_txHead] == 0xFF)
+		_txHead = 0;
+	record = _txBuf + _txHead;
+	if (record[1])
+		ok = writeEvent((const char*)record + 2, record[0]);
+	else
+		ok = writeResponse(IPAddress(record[2], record[3], record[4], record[5]), record[6] | ((unsigned int)record[7] << 8), (const char*)record + 8, record[0]);
+	dropTx();
+	return ok;
+}
+
+// Remove the oldest queued datagram
+void Arduino_UDP::dropTx() {
+	int size;
+
+	if (_txHead >= UDP_TX_QUEUE || _txBuf[_txHead] == 0xFF)
+		_txHead = 0;
+	size = _txBuf[_txHead] + (_txBuf[_txHead + 1] ? 2 : 8);
+	_txHead += size;
+	_txBytes -= size;
+	_txCount--;
+}
+
+// Slot of a subscriber or -1
+int Arduino_UDP::findSubscriber(IPAddress ip, unsigned int port) {
+	int i;
+
+	for (i = 0; i < UDP_SUBSCRIBERS; i++) {
+		if (_subUsed[i] && _subPort[i] == port && _subIp[i][0] == ip[0] && _subIp[i][1] == ip[1] && _subIp[i][2] == ip[2] && _subIp[i][3] == ip[3])
+			return i;
+	}
+	return -1;
+}
+
+// Drop subscribers whose lease has run out
+void Arduino_UDP::expireSubscribers() {
+	int i;
+	unsigned long now;
+
+	now = millis();
+	for (i = 0; i < UDP_SUBSCRIBERS; i++) {
+		if (_subUsed[i] && _subExpires[i] != 0 && (long)(now - _subExpires[i]) >= 0)
+			_subUsed[i] = false;
+	}
+}
+
+// Remove the staged event with the given key
+void Arduino_UDP::dropEvent(byte key) {
+	int i, j;
+	int off, size;
+
+	for (i = 0; i < UDP_EVENT_KEYS; i++) {
+		if (_evntKey[i] == key)
+			break;
+	}
+	if (i >= UDP_EVENT_KEYS)
+		return;
+	off = _evntOff[i];
+	size = _evntSize[i];
+	memmove(_evntBuf + off, _evntBuf + off + size, _evntLen - off - size);
+	_evntLen -= size;
+	_evntKey[i] = 0;
+	// Later events have moved down
+	for (j = 0; j < UDP_EVENT_KEYS; j++) {
+		if (_evntKey[j] != 0 && _evntOff[j] > off)
+			_evntOff[j] -= size;
+	}
+}
+
+// Data available?
+int Arduino_UDP::queryPacket() {
+	int packetSize = _udp.parsePacket();
+  //Serial.println(packetSize);
+	  if (packetSize)
+	    return packetSize;
+	   else
+     return 0;
+}
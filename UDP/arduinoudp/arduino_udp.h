@@ -1,32 +1,112 @@
-/*
-  arduino_udp.h - Library for managing a udp connection
-*/
-
-#ifndef arduino_udp_h
-#define arduino_udp_h
-
-#include "Arduino.h"
-#include <Ethernet.h>                // Base Ethernet lib
-#include <EthernetUdp.h>             // UDP library from: bjoern@cs.stanford.edu 12/30/2008
-
-class Arduino_UDP
-{
-  public:
-    Arduino_UDP(byte *mac, byte *ip, unsigned int cmd_port, unsigned int evnt_port);
-
-	// Method prototypes
-	bool doRead(char* packet_buffer);
-	bool sendResponse(char* reply_buffer);
-  bool sendEvent(char* evnt_buffer);
-
-  private:
-  	// Net info
-	int _cmd_port;
-	int _evnt_port;
-	EthernetUDP *_udp;
-
-	// Method prototypes
-	int queryPacket();
-};
-
-#endif
+/*
+  arduino_udp.h - Library for managing a udp connection
+*/
+
+#ifndef arduino_udp_h
+#define arduino_udp_h
+
+#include "Arduino.h"
+#include <Ethernet.h>                // Base Ethernet lib
+#include <EthernetUdp.h>             // UDP library from: bjoern@cs.stanford.edu 12/30/2008
+
+// Event batching, bytes staged and keyed events that can be replaced
+#define UDP_EVENT_BATCH 64
+#define UDP_EVENT_KEYS 4
+// Number of event subscribers
+#define UDP_SUBSCRIBERS 4
+// Transmit queue size in bytes, each datagram takes its length plus a
+// 2 byte header, 8 for a reply
+#define UDP_TX_QUEUE 128
+// Bytes used on AVR on top of the EthernetUDP instance
+#define UDP_FOOTPRINT 291
+
+// Transmit queue policy, what to do when a datagram does not fit
+enum {
+  UDP_TX_DIRECT = 0,    // No queue, send from the calling code
+  UDP_DROP_NEWEST = 1,  // Drop the datagram being queued
+  UDP_DROP_OLDEST = 2   // Drop queued datagrams until it fits
+};
+
+class Arduino_UDP
+{
+  public:
+    Arduino_UDP(byte *mac, byte *ip, unsigned int cmd_port, unsigned int evnt_port);
+    Arduino_UDP(unsigned int cmd_port, unsigned int evnt_port);
+
+	// Method prototypes
+	void begin(byte *mac, byte *ip);
+	bool doRead(char* packet_buffer);
+	int doRead(char* packet_buffer, int capacity);
+	int beginRead();
+	int readChunk(char* buffer, int capacity);
+	int remaining();
+	IPAddress remoteIP();
+	unsigned int remotePort();
+	bool sendResponse(char* reply_buffer);
+	bool sendResponse(const char* reply_buffer, int length);
+  bool sendEvent(char* evnt_buffer);
+  bool sendEvent(const char* evnt_buffer, int length, byte key = 0);
+  void setEventBatch(unsigned int interval_ms);
+  bool flushEvents();
+  void service(unsigned int budget_us = 0);
+  void setTxQueue(byte policy);
+  int txPending();
+  int txPeak();
+  unsigned long txDropped();
+  unsigned long eventsSubmitted();
+  unsigned long eventDatagrams();
+  bool subscribe(IPAddress ip, unsigned int port, unsigned long lease_ms);
+  bool unsubscribe(IPAddress ip, unsigned int port);
+  int subscribers();
+  unsigned int sendFailures(IPAddress ip, unsigned int port);
+
+  private:
+  	// Net info
+	int _cmd_port;
+	int _evnt_port;
+	EthernetUDP _udp;
+
+	// Event batching
+	unsigned int _batchInterval;
+	char _evntBuf[UDP_EVENT_BATCH];
+	int _evntLen;
+	unsigned long _evntTime;
+	byte _evntKey[UDP_EVENT_KEYS];
+	byte _evntOff[UDP_EVENT_KEYS];
+	byte _evntSize[UDP_EVENT_KEYS];
+	unsigned long _eventsSubmitted;
+	unsigned long _eventDatagrams;
+
+	// Event subscribers
+	bool _subUsed[UDP_SUBSCRIBERS];
+	byte _subIp[UDP_SUBSCRIBERS][4];
+	unsigned int _subPort[UDP_SUBSCRIBERS];
+	unsigned long _subExpires[UDP_SUBSCRIBERS];
+	unsigned int _subFailures[UDP_SUBSCRIBERS];
+
+	// Transmit queue
+	byte _txPolicy;
+	byte _txBuf[UDP_TX_QUEUE];
+	int _txHead;
+	int _txTail;
+	int _txCount;
+	int _txBytes;
+	int _txPeak;
+	unsigned long _txDropped;
+
+	// Method prototypes
+	int queryPacket();
+	void initVars();
+	bool postEvent(const char* evnt_buffer, int length);
+	bool writeEvent(const char* evnt_buffer, int length);
+	bool writeResponse(IPAddress ip, unsigned int port, const char* reply_buffer, int length);
+	bool queueTx(bool event, const char* buffer, int length);
+	int txSpace(int size);
+	bool sendTx();
+	void dropTx();
+	void dropEvent(byte key);
+	int findSubscriber(IPAddress ip, unsigned int port);
+	void expireSubscribers();
+};
+
+#endif
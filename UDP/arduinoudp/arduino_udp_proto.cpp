@@ -0,0 +1,356 @@
+/*
+  arduino_udp_proto.cpp - Binary command protocol over Arduino_UDP
+*/
+
+#include "arduino_udp_proto.h"
+
+// ==============================================================
+// PUBLIC
+
+#if defined(__AVR__)
+// Catch growth in the RAM used, raise PROTO_FOOTPRINT deliberately
+static_assert(sizeof(Arduino_UDPProto) <= PROTO_FOOTPRINT, "Arduino_UDPProto has grown");
+#endif
+
+// Constructor
+Arduino_UDPProto::Arduino_UDPProto(Arduino_UDP *udp) {
+	int i;
+
+	_udp = udp;
+	for (i = 0; i < PROTO_MAX_OPCODES; i++)
+		_handlers[i] = 0;
+	_eventSeq = 0;
+	_badFrames = 0;
+	_unknownOpcodes = 0;
+	_track = false;
+	_client = -1;
+	for (i = 0; i < PROTO_CLIENTS; i++)
+		_clientUsed[i] = false;
+	_nextClient = 0;
+	for (i = 0; i < PROTO_CACHE; i++)
+		_cacheLen[i] = 0;
+	_nextCache = 0;
+	_cacheHits = 0;
+	_cacheMisses = 0;
+	_dropped = 0;
+}
+
+// Register the handler for an opcode
+bool Arduino_UDPProto::addHandler(byte opcode, ProtoHandler handler) {
+	if (opcode >= PROTO_MAX_OPCODES)
+		return false;
+	_handlers[opcode] = handler;
+	return true;
+}
+
+// Read and dispatch one request
+// Returns the opcode handled, 0 if nothing was waiting, -1 if the
+// request was bad or PROTO_DUPLICATE if it was not run again. A datagram
+// longer than a frame is bad even if it starts with one.
+int Arduino_UDPProto::poll() {
+	ProtoFrame request;
+	ProtoHandler handler;
+	int size, length;
+
+	size = _udp->beginRead();
+	if (size == 0)
+		return 0;
+	length = 0;
+	if (size <= PROTO_MAX_FRAME)
+		length = _udp->readChunk((char*)_rx, size);
+	if (length != size || decode(_rx, length, &request) < 0) {
+		_badFrames++;
+		return -1;
+	}
+	// A retransmitted request is answered from the cache, not run again
+	if (_track && isDuplicate(&request))
+		return PROTO_DUPLICATE;
+
+	handler = 0;
+	if (request.opcode < PROTO_MAX_OPCODES)
+		handler = _handlers[request.opcode];
+	if (request.opcode == PROTO_SUBSCRIBE || request.opcode == PROTO_UNSUBSCRIBE) {
+		length = subscribe(&request);
+	} else if (handler == 0) {
+		_unknownOpcodes++;
+		length = -1;
+	} else {
+		length = handler(&request, _tx + PROTO_HEADER_SIZE);
+	}
+	if (length < 0 || length > PROTO_MAX_PAYLOAD) {
+		_tx[PROTO_HEADER_SIZE] = request.opcode;
+		sendReply(PROTO_ERROR, request.seq, 1);
+		return -1;
+	}
+	sendReply(request.opcode | PROTO_REPLY, request.seq, length);
+	return request.opcode;
+}
+
+// Send a status event
+bool Arduino_UDPProto::sendEvent(const ProtoStatus *status) {
+	ProtoFrame frame;
+	int length;
+
+	frame.opcode = PROTO_EVENT;
+	frame.seq = _eventSeq++;
+	frame.payload = _tx + PROTO_HEADER_SIZE;
+	frame.len = putStatus(frame.payload, status);
+	length = encode(_tx, PROTO_MAX_FRAME, &frame);
+	// Keyed by axis so a batch carries only the latest status of each
+	return _udp->sendEvent((const char*)_tx, length, status->axis + 1);
+}
+
+// Track the sequence numbers of each client
+// A request with the sequence number last run for that client gets the
+// cached reply and an older one is dropped, so a retransmitted command is
+// never run twice. Clients must then number requests upwards. A client
+// that starts again PROTO_SEQ_WINDOW or more below its last number is
+// taken to have restarted, one that restarts nearer has its first
+// requests dropped until it passes it.
+void Arduino_UDPProto::trackClients(bool enable) {
+	_track = enable;
+}
+
+// Duplicate requests answered from the cache
+unsigned long Arduino_UDPProto::cacheHits() {
+	return _cacheHits;
+}
+
+// New requests that had to be run
+unsigned long Arduino_UDPProto::cacheMisses() {
+	return _cacheMisses;
+}
+
+// Stale requests, or duplicates whose reply was not cached
+unsigned long Arduino_UDPProto::dropped() {
+	return _dropped;
+}
+
+// Frames too short or with a length that does not match
+unsigned long Arduino_UDPProto::badFrames() {
+	return _badFrames;
+}
+
+// Requests with no handler
+unsigned long Arduino_UDPProto::unknownOpcodes() {
+	return _unknownOpcodes;
+}
+
+// Encode a frame
+// Returns the frame length or -1 if it does not fit.
+int Arduino_UDPProto::encode(byte *buffer, int capacity, const ProtoFrame *frame) {
+	if (frame->len > PROTO_MAX_PAYLOAD || PROTO_HEADER_SIZE + frame->len > capacity)
+		return -1;
+	buffer[0] = frame->opcode;
+	buffer[1] = frame->seq & 0xFF;
+	buffer[2] = frame->seq >> 8;
+	buffer[3] = frame->len;
+	// The payload may already be in place
+	if (frame->payload != buffer + PROTO_HEADER_SIZE)
+		memcpy(buffer + PROTO_HEADER_SIZE, frame->payload, frame->len);
+	return PROTO_HEADER_SIZE + frame->len;
+}
+
+// Decode a frame in place
+// The payload is left in the buffer. Returns the payload length or -1 if
+// the frame is bad.
+int Arduino_UDPProto::decode(byte *buffer, int length, ProtoFrame *frame) {
+	if (length < PROTO_HEADER_SIZE)
+		return -1;
+	frame->opcode = buffer[0];
+	frame->seq = buffer[1] | ((unsigned int)buffer[2] << 8);
+	frame->len = buffer[3];
+	if (frame->len > PROTO_MAX_PAYLOAD || PROTO_HEADER_SIZE + frame->len != length)
+		return -1;
+	frame->payload = buffer + PROTO_HEADER_SIZE;
+	return frame->len;
+}
+
+// Payload with just an axis
+bool Arduino_UDPProto::getAxis(const ProtoFrame *frame, byte *axis) {
+	if (frame->len != 1)
+		return false;
+	*axis = frame->payload[0];
+	return true;
+}
+
+// Move payload, axis and position in centidegrees
+bool Arduino_UDPProto::getMove(const ProtoFrame *frame, ProtoMove *move) {
+	if (frame->len != 5)
+		return false;
+	move->axis = frame->payload[0];
+	move->cdeg = getLong(frame->payload + 1);
+	return true;
+}
+
+int Arduino_UDPProto::putMove(byte *payload, const ProtoMove *move) {
+	payload[0] = move->axis;
+	putLong(payload + 1, move->cdeg);
+	return 5;
+}
+
+// Status payload, axis, motor state, fault and position in centidegrees
+bool Arduino_UDPProto::getStatus(const ProtoFrame *frame, ProtoStatus *status) {
+	if (frame->len != 7)
+		return false;
+	status->axis = frame->payload[0];
+	status->state = frame->payload[1];
+	status->fault = frame->payload[2];
+	status->cdeg = getLong(frame->payload + 3);
+	return true;
+}
+
+int Arduino_UDPProto::putStatus(byte *payload, const ProtoStatus *status) {
+	payload[0] = status->axis;
+	payload[1] = status->state;
+	payload[2] = status->fault;
+	putLong(payload + 3, status->cdeg);
+	return 7;
+}
+
+// ==============================================================
+// PRIVATE
+
+// Send a reply whose payload is already in _tx
+bool Arduino_UDPProto::sendReply(byte opcode, unsigned int seq, int length) {
+	ProtoFrame frame;
+
+	frame.opcode = opcode;
+	frame.seq = seq;
+	frame.len = length;
+	frame.payload = _tx + PROTO_HEADER_SIZE;
+	length = encode(_tx, PROTO_MAX_FRAME, &frame);
+	if (length < 0)
+		return false;
+	if (_track)
+		cacheReply(seq, length);
+	return _udp->sendResponse((const char*)_tx, length);
+}
+
+// Test for a request already seen from this client
+// Resends the cached reply to a duplicate. A new request is recorded as
+// the latest for the client. A request under a number already run but
+// with another opcode, or from far behind, means the client restarted and
+// what was kept for it is forgotten.
+bool Arduino_UDPProto::isDuplicate(const ProtoFrame *request) {
+	const byte *reply;
+	bool restarted;
+	int i;
+	int diff;
+
+	_client = findClient();
+	restarted = false;
+	if (_clientUsed[_client]) {
+		diff = (int16_t)(request->seq - _clientSeq[_client]);
+		if (diff <= 0 && diff > -PROTO_SEQ_WINDOW) {
+			for (i = 0; i < PROTO_CACHE; i++) {
+				if (_cacheLen[i] > 0 && _cacheClient[i] == _client && _cacheSeq[i] == request->seq)
+					break;
+			}
+			if (i == PROTO_CACHE) {
+				_dropped++;
+				return true;
+			}
+			// The reply names the request opcode, an error reply in its payload
+			reply = _cacheFrame[i];
+			if (reply[0] == (request->opcode | PROTO_REPLY) || (reply[0] == PROTO_ERROR && reply[PROTO_HEADER_SIZE] == request->opcode)) {
+				_cacheHits++;
+				_udp->sendResponse((const char*)reply, _cacheLen[i]);
+				return true;
+			}
+			restarted = true;
+		} else if (diff <= 0) {
+			restarted = true;
+		}
+	}
+	if (restarted)
+		forgetReplies(_client);
+	_clientUsed[_client] = true;
+	_clientSeq[_client] = request->seq;
+	_cacheMisses++;
+	return false;
+}
+
+// Slot for the client that sent the current request
+// A new client takes the next slot in turn and loses what was cached for
+// the client that had it.
+int Arduino_UDPProto::findClient() {
+	IPAddress ip;
+	unsigned int port;
+	int i;
+
+	ip = _udp->remoteIP();
+	port = _udp->remotePort();
+	for (i = 0; i < PROTO_CLIENTS; i++) {
+		if (_clientUsed[i] && _clientPort[i] == port && _clientIp[i][0] == ip[0] && _clientIp[i][1] == ip[1] && _clientIp[i][2] == ip[2] && _clientIp[i][3] == ip[3])
+			return i;
+	}
+	i = _nextClient;
+	_nextClient = (_nextClient + 1) % PROTO_CLIENTS;
+	_clientUsed[i] = false;
+	_clientPort[i] = port;
+	_clientIp[i][0] = ip[0];
+	_clientIp[i][1] = ip[1];
+	_clientIp[i][2] = ip[2];
+	_clientIp[i][3] = ip[3];
+	forgetReplies(i);
+	return i;
+}
+
+// Drop the replies cached for a client slot
+void Arduino_UDPProto::forgetReplies(int client) {
+	int i;
+
+	for (i = 0; i < PROTO_CACHE; i++) {
+		if (_cacheClient[i] == client)
+			_cacheLen[i] = 0;
+	}
+}
+
+// Keep the reply frame in _tx for the current client
+void Arduino_UDPProto::cacheReply(unsigned int seq, int length) {
+	int i;
+
+	if (_client < 0)
+		return;
+	i = _nextCache;
+	_nextCache = (_nextCache + 1) % PROTO_CACHE;
+	_cacheClient[i] = _client;
+	_cacheSeq[i] = seq;
+	_cacheLen[i] = length;
+	memcpy(_cacheFrame[i], _tx, length);
+}
+
+// Subscribe the sender to events, or unsubscribe it
+// Events go to the sender's address on the port in the request.
+int Arduino_UDPProto::subscribe(const ProtoFrame *request) {
+	unsigned int port;
+	unsigned long lease;
+
+	if (request->opcode == PROTO_UNSUBSCRIBE) {
+		if (request->len != 2)
+			return -1;
+		port = request->payload[0] | ((unsigned int)request->payload[1] << 8);
+		_udp->unsubscribe(_udp->remoteIP(), port);
+		return 0;
+	}
+	if (request->len != 4)
+		return -1;
+	port = request->payload[0] | ((unsigned int)request->payload[1] << 8);
+	lease = request->payload[2] | ((unsigned int)request->payload[3] << 8);
+	if (!_udp->subscribe(_udp->remoteIP(), port, lease * 1000UL))
+		return -1;
+	return 0;
+}
+
+// Little endian long
+long Arduino_UDPProto::getLong(const byte *p) {
+	return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+void Arduino_UDPProto::putLong(byte *p, long value) {
+	p[0] = value & 0xFF;
+	p[1] = (value >> 8) & 0xFF;
+	p[2] = (value >> 16) & 0xFF;
+	p[3] = (value >> 24) & 0xFF;
+}
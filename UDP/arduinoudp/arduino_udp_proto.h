@@ -0,0 +1,136 @@
+/*
+  arduino_udp_proto.h - Binary command protocol over Arduino_UDP
+*/
+
+#ifndef arduino_udp_proto_h
+#define arduino_udp_proto_h
+
+#include "Arduino.h"
+#include "arduino_udp.h"
+
+// Frame layout, multi-byte values are little endian
+//   [0]     opcode
+//   [1..2]  sequence number
+//   [3]     payload length
+//   [4..]   payload
+#define PROTO_HEADER_SIZE 4
+#define PROTO_MAX_PAYLOAD 32
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+// Opcodes below this can have a handler
+#define PROTO_MAX_OPCODES 16
+// Clients tracked for duplicate requests and replies cached for them,
+// each cached reply takes PROTO_MAX_FRAME bytes
+#define PROTO_CLIENTS 4
+#define PROTO_CACHE 4
+// A sequence number this far back or more is from a client that restarted
+#define PROTO_SEQ_WINDOW 16
+// Bytes used on AVR by an Arduino_UDPProto instance
+#define PROTO_FOOTPRINT 329
+// poll() result for a retransmitted request, answered from the cache or dropped
+#define PROTO_DUPLICATE -2
+
+// Opcodes
+// A reply has the request opcode with PROTO_REPLY set and the same sequence number
+enum {
+  PROTO_MOVE = 1,       // axis, cdeg
+  PROTO_HOME = 2,       // axis
+  PROTO_CALIBRATE = 3,  // axis
+  PROTO_ABORT = 4,      // axis
+  PROTO_QUERY = 5,      // axis, reply is a status
+  PROTO_SUBSCRIBE = 6,  // event port, lease in seconds (0 never runs out)
+  PROTO_UNSUBSCRIBE = 7, // event port
+  PROTO_EVENT = 0x40,   // Status sent unasked
+  PROTO_ERROR = 0x7F,   // Reply to a bad request, payload is the request opcode
+  PROTO_REPLY = 0x80
+};
+
+// A frame, the payload points into the caller's buffer
+struct ProtoFrame {
+  byte opcode;
+  unsigned int seq;
+  byte len;
+  byte *payload;
+};
+
+// Typed payloads
+struct ProtoMove {
+  byte axis;
+  long cdeg;
+};
+
+struct ProtoStatus {
+  byte axis;
+  byte state;
+  byte fault;
+  long cdeg;
+};
+
+// Handler for an opcode
+// Writes the reply payload and returns its length, or -1 to reply with
+// PROTO_ERROR.
+typedef int (*ProtoHandler)(const ProtoFrame *request, byte *reply);
+
+class Arduino_UDPProto
+{
+  public:
+    Arduino_UDPProto(Arduino_UDP *udp);
+
+	// Method prototypes
+	bool addHandler(byte opcode, ProtoHandler handler);
+	int poll();
+	bool sendEvent(const ProtoStatus *status);
+	void trackClients(bool enable);
+	unsigned long badFrames();
+	unsigned long unknownOpcodes();
+	unsigned long cacheHits();
+	unsigned long cacheMisses();
+	unsigned long dropped();
+
+	// Framing
+	static int encode(byte *buffer, int capacity, const ProtoFrame *frame);
+	static int decode(byte *buffer, int length, ProtoFrame *frame);
+	static bool getAxis(const ProtoFrame *frame, byte *axis);
+	static bool getMove(const ProtoFrame *frame, ProtoMove *move);
+	static int putMove(byte *payload, const ProtoMove *move);
+	static bool getStatus(const ProtoFrame *frame, ProtoStatus *status);
+	static int putStatus(byte *payload, const ProtoStatus *status);
+
+  private:
+	Arduino_UDP *_udp;
+	ProtoHandler _handlers[PROTO_MAX_OPCODES];
+	byte _rx[PROTO_MAX_FRAME];
+	byte _tx[PROTO_MAX_FRAME];
+	unsigned int _eventSeq;
+	unsigned long _badFrames;
+	unsigned long _unknownOpcodes;
+
+	// Duplicate suppression, last sequence number run for each client
+	bool _track;
+	int _client;
+	byte _clientIp[PROTO_CLIENTS][4];
+	unsigned int _clientPort[PROTO_CLIENTS];
+	unsigned int _clientSeq[PROTO_CLIENTS];
+	bool _clientUsed[PROTO_CLIENTS];
+	byte _nextClient;
+	// Reply cache
+	byte _cacheClient[PROTO_CACHE];
+	unsigned int _cacheSeq[PROTO_CACHE];
+	byte _cacheLen[PROTO_CACHE];
+	byte _cacheFrame[PROTO_CACHE][PROTO_MAX_FRAME];
+	byte _nextCache;
+	unsigned long _cacheHits;
+	unsigned long _cacheMisses;
+	unsigned long _dropped;
+
+	// Method prototypes
+	bool sendReply(byte opcode, unsigned int seq, int length);
+	bool isDuplicate(const ProtoFrame *request);
+	int findClient();
+	void forgetReplies(int client);
+	void cacheReply(unsigned int seq, int length);
+	int subscribe(const ProtoFrame *request);
+	static long getLong(const byte *p);
+	static void putLong(byte *p, long value);
+};
+
+#endif
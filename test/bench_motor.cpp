@@ -0,0 +1,82 @@
+/*
+  bench_motor.cpp - Motion benchmark on the simulated rotators
+
+  Reports the time taken, final position error and CPU work for standard
+  scenarios. Times are simulated, work is update() calls and core calls.
+*/
+
+#include <stdio.h>
+#include "arduino_motor.h"
+#include "plant.h"
+
+// Pins as in the example sketch
+#define AZ_DIR 22
+#define AZ_PWM 4
+#define AZ_SENSOR 30
+#define AZ_LIMIT 24
+#define EL_DIR 23
+#define EL_PWM 5
+#define EL_SENSOR 31
+#define EL_LIMIT_FWD 25
+#define EL_LIMIT_REV 26
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// Run an operation to completion and report it
+static void run(const char *name, Arduino_Motor &motor, Plant &plant, int span, long target_cdeg) {
+  unsigned long long start;
+  unsigned long calls, updates;
+  double actual;
+
+  start = sim_time_us();
+  calls = sim_calls();
+  updates = 0;
+  while (motor.update()) updates++;
+  // Where the output really is, home is where the reverse switch releases
+  actual = plant.output * span * 100.0 / plant.config.travel;
+  printf("%-22s %-6s %8.0f ms %8.0f cdeg err %8lu updates %9lu calls\n", name,
+    motor.state() == MOTOR_DONE ? "ok" : "FAILED",
+    (sim_time_us() - start) / 1000.0,
+    target_cdeg >= 0 ? target_cdeg - actual : 0.0,
+    updates, sim_calls() - calls);
+}
+
+int main() {
+  sim_reset();
+  {
+    PlantConfig config = plant_az(AZ_DIR, AZ_PWM, AZ_SENSOR, AZ_LIMIT);
+    Plant plant(config);
+    Arduino_Motor motor(0, no_event, AZ_DIR, AZ_PWM, AZ_SENSOR, AZ_LIMIT, 360);
+
+    sim_add_device(&plant);
+    motor.set_speed(40);
+    motor.set_backoff_speed(40);
+    motor.set_soft_limits(10, 50);
+
+    motor.start_calibrate();
+    run("az calibrate", motor, plant, 360, -1);
+    motor.start_move_to_position(180);
+    run("az 0->180", motor, plant, 360, 18000);
+    motor.start_move_to_position(0);
+    run("az 180->0", motor, plant, 360, 0);
+  }
+  sim_reset();
+  {
+    PlantConfig config = plant_el(EL_DIR, EL_PWM, EL_SENSOR, EL_LIMIT_FWD, EL_LIMIT_REV);
+    Plant plant(config);
+    Arduino_Motor motor(1, no_event, EL_DIR, EL_PWM, EL_SENSOR, EL_LIMIT_FWD, EL_LIMIT_REV, 90);
+
+    sim_add_device(&plant);
+    motor.set_speed(40);
+    motor.set_backoff_speed(40);
+    motor.set_soft_limits(10, 50);
+
+    motor.start_calibrate();
+    run("el calibrate", motor, plant, 90, -1);
+    motor.start_move_to_position(90);
+    run("el 0->90", motor, plant, 90, 9000);
+  }
+  return 0;
+}
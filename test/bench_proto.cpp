@@ -0,0 +1,97 @@
+/*
+  bench_proto.cpp - Parse cost of the binary command protocol
+
+  Reports host time per request for decoding a frame, for a full poll()
+  through the simulated socket, and for parsing the same move as text
+  with strcmp and atol as the sketches did. Host times only rank the
+  approaches, the target is far slower.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "arduino_udp.h"
+#include "arduino_udp_proto.h"
+
+#define CMD_PORT 8888
+#define EVNT_PORT 8889
+#define RUNS 1000000L
+
+static byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xEE };
+static byte ip[] = { 192, 168, 1, 178 };
+static volatile long sink;
+
+static int move(const ProtoFrame *request, byte *) {
+  ProtoMove move;
+
+  if (!Arduino_UDPProto::getMove(request, &move))
+    return -1;
+  sink += move.cdeg;
+  return 0;
+}
+
+static double now_ns() {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char *name, double start, long runs, unsigned long transfers) {
+  printf("%-22s %8.1f ns/request %6.1f transfers/request\n", name, (now_ns() - start) / runs, (double)transfers / runs);
+}
+
+int main() {
+  byte frame_buffer[PROTO_MAX_FRAME], reply[SIM_UDP_MAX];
+  char text[32], command[8];
+  ProtoFrame frame;
+  ProtoMove request;
+  IPAddress client(192, 168, 1, 10);
+  int length, axis;
+  long n;
+  double start;
+  char *p;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_MOVE, move);
+
+  request.axis = 0;
+  request.cdeg = 18000;
+  frame.opcode = PROTO_MOVE;
+  frame.seq = 1;
+  frame.payload = frame_buffer + PROTO_HEADER_SIZE;
+  frame.len = Arduino_UDPProto::putMove(frame.payload, &request);
+  length = Arduino_UDPProto::encode(frame_buffer, sizeof(frame_buffer), &frame);
+
+  start = now_ns();
+  for (n = 0; n < RUNS; n++) {
+    Arduino_UDPProto::decode(frame_buffer, length, &frame);
+    Arduino_UDPProto::getMove(&frame, &request);
+    sink += request.cdeg;
+  }
+  report("binary decode", start, RUNS, 0);
+
+  wire->sim_clear();
+  start = now_ns();
+  for (n = 0; n < RUNS; n++) {
+    wire->sim_receive(client, 5000, frame_buffer, length);
+    proto.poll();
+    wire->sim_sent(reply, sizeof(reply));
+  }
+  report("binary poll", start, RUNS, wire->sim_transfers());
+
+  strcpy(text, "MOVE 0 18000");
+  start = now_ns();
+  for (n = 0; n < RUNS; n++) {
+    p = strchr(text, ' ');
+    memcpy(command, text, p - text);
+    command[p - text] = '\0';
+    if (strcmp(command, "MOVE") == 0) {
+      axis = atoi(p + 1);
+      p = strchr(p + 1, ' ');
+      sink += axis + atol(p + 1);
+    }
+  }
+  report("text strcmp/atol", start, RUNS, 0);
+  return 0;
+}
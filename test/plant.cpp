@@ -0,0 +1,113 @@
+/*
+  plant.cpp - Simulated DC motor, encoder, limit switches and gear train
+*/
+
+#include "plant.h"
+
+// ------------------------------------
+// Defaults
+// 3600 pulses over the travel, about 1500 pulses/s at 40% duty.
+PlantConfig plant_az(int dir, int pwm, int sensor, int limit) {
+  PlantConfig c;
+
+  c.dir = dir;
+  c.pwm = pwm;
+  c.sensor = sensor;
+  c.sensor_b = -1;
+  c.limit_fwd = limit;
+  c.limit_rev = limit;
+  c.travel = 3600;
+  c.overtravel = 150;
+  c.start = 1800;
+  c.dead_pwm = 25;
+  c.pps_per_pwm = 20;
+  c.tau_ms = 40;
+  c.coast_tau_ms = 15;
+  c.backlash = 0;
+  return c;
+}
+
+// A shorter travel and a slower motor
+PlantConfig plant_el(int dir, int pwm, int sensor, int limit_fwd, int limit_rev) {
+  PlantConfig c;
+
+  c = plant_az(dir, pwm, sensor, limit_fwd);
+  c.limit_rev = limit_rev;
+  c.travel = 1200;
+  c.start = 600;
+  c.pps_per_pwm = 12;
+  return c;
+}
+
+Plant::Plant(const PlantConfig &c) {
+  config = c;
+  output = c.start;
+  motor = c.start;
+  speed = 0;
+  jammed = false;
+  edges = 0;
+  __a = (motor - floor(motor) < 0.5) ? HIGH : LOW;
+  max_output = output;
+  min_output = output;
+  __outputs();
+}
+
+// ------------------------------------
+// Advance the model
+void Plant::step(double dt_us) {
+  double target, tau, dt, before, half;
+  int pwm;
+
+  dt = dt_us / 1e6;
+  pwm = sim_pwm(config.pwm);
+  target = 0;
+  if (pwm > config.dead_pwm) target = (pwm - config.dead_pwm) * config.pps_per_pwm;
+  if (sim_output(config.dir) == LOW) target = -target;
+  tau = ((pwm > 0) ? config.tau_ms : config.coast_tau_ms) / 1000.0;
+  speed += (target - speed) * min(dt / tau, 1.0);
+  if (jammed) speed = 0;
+
+  before = motor;
+  motor += speed * dt;
+  // The output is only pushed once the free play is taken up
+  half = config.backlash / 2;
+  if (motor - output > half) output = motor - half;
+  if (output - motor > half) output = motor + half;
+  // Hard stops
+  if (output > config.travel + config.overtravel || output < -config.overtravel) {
+    output = constrain(output, -config.overtravel, config.travel + config.overtravel);
+    motor = before;
+    speed = 0;
+  }
+  max_output = max(max_output, output);
+  min_output = min(min_output, output);
+  __outputs();
+}
+
+// ------------------------------------
+// Drive the encoder and switch pins
+void Plant::__outputs() {
+  double f;
+  int a, b;
+  bool fwd, rev;
+
+  // A is high for the first half of each pulse, B is high from a quarter
+  // to three quarters so it is high when A falls going forward
+  f = motor - floor(motor);
+  a = f < 0.5 ? HIGH : LOW;
+  f = (motor - 0.25) - floor(motor - 0.25);
+  b = f < 0.5 ? HIGH : LOW;
+  // Count A falling signed by B, as a quadrature decoder does
+  if (__a == HIGH && a == LOW) edges += (b == HIGH) ? 1 : -1;
+  __a = a;
+  sim_drive(config.sensor, a);
+  if (config.sensor_b != -1) sim_drive(config.sensor_b, b);
+  fwd = output >= config.travel;
+  rev = output <= 0;
+  if (config.limit_fwd == config.limit_rev) {
+    sim_drive(config.limit_fwd, (fwd || rev) ? LOW : HIGH);
+  } else {
+    sim_drive(config.limit_fwd, fwd ? LOW : HIGH);
+    sim_drive(config.limit_rev, rev ? LOW : HIGH);
+  }
+}
@@ -0,0 +1,54 @@
+/*
+  plant.h - Simulated DC motor, encoder, limit switches and gear train
+*/
+
+#ifndef plant_h
+#define plant_h
+
+#include "sim.h"
+
+// Motor and mechanics, positions are in encoder pulses
+struct PlantConfig {
+  int dir;                // Direction pin, HIGH runs forward
+  int pwm;                // PWM pin
+  int sensor;             // Encoder channel A
+  int sensor_b;           // Encoder channel B or -1
+  int limit_fwd;          // Forward limit switch, active LOW
+  int limit_rev;          // Reverse limit switch, the same pin for a single switch
+  double travel;          // Output pulses from the reverse to the forward switch
+  double overtravel;      // Output pulses past a switch to the hard stop
+  double start;           // Output position at start
+  int dead_pwm;           // PWM the motor needs to turn at all
+  double pps_per_pwm;     // Speed in pulses/s for each PWM step above dead_pwm
+  double tau_ms;          // Time constant speeding up or slowing down under power
+  double coast_tau_ms;    // Time constant coasting to a stop
+  double backlash;        // Free play between the motor and the output
+};
+
+// Defaults for an azimuth rotator on pins dir, pwm, sensor, switch
+PlantConfig plant_az(int dir, int pwm, int sensor, int limit);
+// Defaults for an elevation rotator with two switches
+PlantConfig plant_el(int dir, int pwm, int sensor, int limit_fwd, int limit_rev);
+
+class Plant : public SimDevice
+{
+  public:
+    Plant(const PlantConfig &config);
+    void step(double dt_us);
+
+    PlantConfig config;
+    double motor;           // Motor shaft
+    double output;          // After the gears
+    double speed;           // Motor speed in pulses/s
+    bool jammed;            // Held still whatever the drive
+    long edges;             // Falls of A through the encoder, signed
+    double max_output;      // Furthest forward the output has been
+    double min_output;      // Furthest reverse
+
+  private:
+    int __a;
+
+    void __outputs();
+};
+
+#endif
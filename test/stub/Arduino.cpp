@@ -0,0 +1,316 @@
+/*
+  Arduino.cpp - Simulated Arduino core for host builds of the libraries
+*/
+
+#include <stdio.h>
+#include "sim.h"
+
+#define SIM_IRQS 6
+#define SIM_DEVICES 8
+
+struct SimPin {
+  uint8_t mode;
+  int out;
+  int in;
+  int pwm;
+  unsigned long pwm_writes;
+};
+
+static SimPin pins[SIM_PINS];
+static SimDevice *devices[SIM_DEVICES];
+static int num_devices;
+static unsigned long long now_us;
+static unsigned int call_cost;
+static unsigned long calls;
+
+static void (*irq_func[SIM_IRQS])(void);
+static int irq_mode[SIM_IRQS];
+static bool irq_pending[SIM_IRQS];
+static bool irq_enabled;
+static bool in_isr;
+static unsigned long irqs_run;
+
+HardwareSerial Serial;
+
+// ==============================================================
+// Simulator control
+
+void sim_reset() {
+  int i;
+
+  memset(pins, 0, sizeof(pins));
+  // Inputs float high through the pullups
+  for (i = 0; i < SIM_PINS; i++) pins[i].in = HIGH;
+  num_devices = 0;
+  now_us = 0;
+  call_cost = 4;
+  calls = 0;
+  for (i = 0; i < SIM_IRQS; i++) {
+    irq_func[i] = 0;
+    irq_pending[i] = false;
+  }
+  irq_enabled = true;
+  in_isr = false;
+  irqs_run = 0;
+}
+
+void sim_add_device(SimDevice *device) {
+  if (num_devices < SIM_DEVICES) devices[num_devices++] = device;
+}
+
+unsigned long long sim_time_us() {
+  return now_us;
+}
+
+void sim_advance(unsigned long us) {
+  unsigned long dt;
+  int i;
+
+  while (us > 0) {
+    dt = min(us, (unsigned long)SIM_STEP);
+    now_us += dt;
+    for (i = 0; i < num_devices; i++) devices[i]->step(dt);
+    us -= dt;
+  }
+}
+
+void sim_set_call_cost(unsigned int us) {
+  call_cost = us;
+}
+
+unsigned long sim_calls() {
+  return calls;
+}
+
+// A core call takes time on the target
+static void sim_call() {
+  calls++;
+  if (!in_isr) sim_advance(call_cost);
+}
+
+// ------------------------------------
+// Pins
+
+static int pin_irq(uint8_t pin) {
+  switch (pin) {
+    case 2: return 0;
+    case 3: return 1;
+    case 21: return 2;
+    case 20: return 3;
+    case 19: return 4;
+    case 18: return 5;
+  }
+  return NOT_AN_INTERRUPT;
+}
+
+static void run_isr(int irq) {
+  in_isr = true;
+  irqs_run++;
+  irq_func[irq]();
+  in_isr = false;
+}
+
+void sim_drive(uint8_t pin, int level) {
+  int irq, old;
+  bool edge;
+
+  if (pin >= SIM_PINS) return;
+  old = pins[pin].in;
+  pins[pin].in = level;
+  irq = pin_irq(pin);
+  if (old == level || irq == NOT_AN_INTERRUPT || irq_func[irq] == 0) return;
+  switch (irq_mode[irq]) {
+    case FALLING: edge = (level == LOW); break;
+    case RISING: edge = (level == HIGH); break;
+    default: edge = true; break;
+  }
+  if (!edge) return;
+  if (irq_enabled && !in_isr)
+    run_isr(irq);
+  else
+    irq_pending[irq] = true;
+}
+
+int sim_output(uint8_t pin) {
+  return (pin < SIM_PINS) ? pins[pin].out : LOW;
+}
+
+int sim_pwm(uint8_t pin) {
+  return (pin < SIM_PINS) ? pins[pin].pwm : 0;
+}
+
+unsigned long sim_pwm_writes(uint8_t pin) {
+  return (pin < SIM_PINS) ? pins[pin].pwm_writes : 0;
+}
+
+bool sim_interrupts_enabled() {
+  return irq_enabled;
+}
+
+unsigned long sim_interrupts_run() {
+  return irqs_run;
+}
+
+// ------------------------------------
+// Encoder pulse generator
+// Each pulse is four quarter steps of the A and B channels. Forward A
+// falls with B high.
+
+SimPulseTrain::SimPulseTrain(uint8_t pin, int pin_b, long count, unsigned long rate_hz) {
+  _pin = pin;
+  _pin_b = pin_b;
+  _count = count;
+  _quarter_us = 250000.0 / rate_hz;
+  _phase_us = 0;
+  _quarter = 0;
+  sent = 0;
+}
+
+void SimPulseTrain::step(double dt_us) {
+  static const int a[4] = { HIGH, HIGH, LOW, LOW };
+  static const int b[4] = { LOW, HIGH, HIGH, LOW };
+
+  _phase_us += dt_us;
+  while (!done() && _phase_us >= _quarter_us) {
+    _phase_us -= _quarter_us;
+    _quarter = (_quarter + 1) & 3;
+    // B leads A going forward and lags it in reverse
+    if (_pin_b != -1) sim_drive(_pin_b, (_count >= 0) ? b[_quarter] : !b[_quarter]);
+    sim_drive(_pin, a[_quarter]);
+    if (_quarter == 2) sent++;
+  }
+}
+
+bool SimPulseTrain::done() {
+  return sent >= labs(_count);
+}
+
+// ==============================================================
+// Core
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < SIM_PINS) pins[pin].mode = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  sim_call();
+  // Writing an input sets its pullup, the level is left to the devices
+  if (pin < SIM_PINS && pins[pin].mode == OUTPUT) pins[pin].out = val;
+}
+
+int digitalRead(uint8_t pin) {
+  sim_call();
+  if (pin >= SIM_PINS) return LOW;
+  if (pins[pin].mode == OUTPUT) return pins[pin].out;
+  return pins[pin].in;
+}
+
+void analogWrite(uint8_t pin, int val) {
+  sim_call();
+  if (pin >= SIM_PINS) return;
+  pins[pin].pwm = constrain(val, 0, 255);
+  pins[pin].pwm_writes++;
+}
+
+unsigned long millis() {
+  sim_call();
+  return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros() {
+  sim_call();
+  return (unsigned long)now_us;
+}
+
+void delay(unsigned long ms) {
+  sim_advance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_advance(us);
+}
+
+int digitalPinToInterrupt(uint8_t pin) {
+  return pin_irq(pin);
+}
+
+void attachInterrupt(uint8_t irq, void (*func)(void), int mode) {
+  if (irq >= SIM_IRQS) return;
+  irq_func[irq] = func;
+  irq_mode[irq] = mode;
+  irq_pending[irq] = false;
+}
+
+void detachInterrupt(uint8_t irq) {
+  if (irq < SIM_IRQS) irq_func[irq] = 0;
+}
+
+void noInterrupts() {
+  irq_enabled = false;
+}
+
+// Run anything that was held off, one per line as the flags latch
+void interrupts() {
+  int i;
+
+  irq_enabled = true;
+  for (i = 0; i < SIM_IRQS; i++) {
+    if (irq_pending[i] && irq_func[i]) {
+      irq_pending[i] = false;
+      run_isr(i);
+    }
+  }
+}
+
+// ------------------------------------
+// Output
+
+size_t Print::write(const char *str) {
+  size_t n;
+
+  for (n = 0; str[n]; n++) write((uint8_t)str[n]);
+  return n;
+}
+
+size_t Print::print(const char *str) { return write(str); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+
+size_t Print::print(long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  return write(buf);
+}
+
+size_t Print::print(unsigned long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  return write(buf);
+}
+
+size_t Print::print(double n) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.2f", n);
+  return write(buf);
+}
+
+size_t Print::print(int n) { return print((long)n); }
+size_t Print::print(unsigned int n) { return print((unsigned long)n); }
+size_t Print::println() { return write("\r\n"); }
+size_t Print::println(const char *str) { return print(str) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int n) { return print(n) + println(); }
+size_t Print::println(unsigned int n) { return print(n) + println(); }
+size_t Print::println(long n) { return print(n) + println(); }
+size_t Print::println(unsigned long n) { return print(n) + println(); }
+size_t Print::println(double n) { return print(n) + println(); }
+
+void HardwareSerial::begin(unsigned long) {
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  static int verbose = -1;
+
+  if (verbose < 0) verbose = getenv("SIM_VERBOSE") != 0;
+  if (verbose && c != '\r') putchar(c);
+  return 1;
+}
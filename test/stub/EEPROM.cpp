@@ -0,0 +1,71 @@
+/*
+  EEPROM.cpp - Simulated EEPROM for host builds of the libraries
+*/
+
+#include <string.h>
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() {
+  _file = 0;
+  sim_erase();
+}
+
+uint8_t EEPROMClass::read(int idx) {
+  if (idx < 0 || idx >= SIM_EEPROM_SIZE) return 0xFF;
+  return _data[idx];
+}
+
+void EEPROMClass::write(int idx, uint8_t val) {
+  if (idx < 0 || idx >= SIM_EEPROM_SIZE) return;
+  _data[idx] = val;
+  _writes++;
+  _save(idx, 1);
+}
+
+// Only written if changed, as on the target
+void EEPROMClass::update(int idx, uint8_t val) {
+  if (read(idx) != val) write(idx, val);
+}
+
+uint16_t EEPROMClass::length() {
+  return SIM_EEPROM_SIZE;
+}
+
+void EEPROMClass::sim_erase() {
+  memset(_data, 0xFF, sizeof(_data));
+  _writes = 0;
+  _save(0, SIM_EEPROM_SIZE);
+}
+
+unsigned long EEPROMClass::sim_writes() {
+  return _writes;
+}
+
+bool EEPROMClass::sim_file(const char *path) {
+  if (_file) fclose(_file);
+  _file = 0;
+  if (!path) return true;
+
+  _file = fopen(path, "r+b");
+  if (_file) {
+    // A short file reads as erased beyond its end
+    memset(_data, 0xFF, sizeof(_data));
+    if (fread(_data, 1, sizeof(_data), _file) < sizeof(_data)) _save(0, SIM_EEPROM_SIZE);
+  } else {
+    _file = fopen(path, "w+b");
+    if (!_file) return false;
+    _save(0, SIM_EEPROM_SIZE);
+  }
+  _writes = 0;
+  return true;
+}
+
+// Write through to the backing file
+void EEPROMClass::_save(int idx, int len) {
+  if (!_file) return;
+  fseek(_file, idx, SEEK_SET);
+  fwrite(_data + idx, 1, len, _file);
+  fflush(_file);
+}
@@ -0,0 +1,40 @@
+/*
+  EEPROM.h - Simulated EEPROM for host builds of the libraries
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Size of the Mega 2560 EEPROM
+#define SIM_EEPROM_SIZE 4096
+
+class EEPROMClass
+{
+  public:
+    EEPROMClass();
+    uint8_t read(int idx);
+    void write(int idx, uint8_t val);
+    void update(int idx, uint8_t val);
+    uint16_t length();
+
+    // Simulator control, erased to 0xFF as a new part
+    void sim_erase();
+    unsigned long sim_writes();
+    // Keep the contents in a file so they survive a restart, loaded if it
+    // exists and written through from then on. 0 detaches the file.
+    bool sim_file(const char *path);
+
+  private:
+    uint8_t _data[SIM_EEPROM_SIZE];
+    unsigned long _writes;
+    FILE *_file;
+
+    void _save(int idx, int len);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
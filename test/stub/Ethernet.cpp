@@ -0,0 +1,30 @@
+/*
+  Ethernet.cpp - Simulated Ethernet shield for host builds of the libraries
+*/
+
+#include "Ethernet.h"
+
+EthernetClass Ethernet;
+
+IPAddress::IPAddress() {
+  _addr[0] = _addr[1] = _addr[2] = _addr[3] = 0;
+}
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  _addr[0] = a;
+  _addr[1] = b;
+  _addr[2] = c;
+  _addr[3] = d;
+}
+
+bool IPAddress::operator==(const IPAddress &other) const {
+  return _addr[0] == other._addr[0] && _addr[1] == other._addr[1] && _addr[2] == other._addr[2] && _addr[3] == other._addr[3];
+}
+
+void EthernetClass::begin(uint8_t *, IPAddress ip) {
+  _ip = ip;
+}
+
+IPAddress EthernetClass::localIP() {
+  return _ip;
+}
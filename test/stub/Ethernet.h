@@ -0,0 +1,24 @@
+/*
+  Ethernet.h - Simulated Ethernet shield for host builds of the libraries
+*/
+
+#ifndef Ethernet_h
+#define Ethernet_h
+
+#include <stdint.h>
+#include "IPAddress.h"
+#include "EthernetUdp.h"
+
+class EthernetClass
+{
+  public:
+    void begin(uint8_t *mac, IPAddress ip);
+    IPAddress localIP();
+
+  private:
+    IPAddress _ip;
+};
+
+extern EthernetClass Ethernet;
+
+#endif
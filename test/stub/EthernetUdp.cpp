@@ -0,0 +1,180 @@
+/*
+  EthernetUdp.cpp - Simulated UDP socket for host builds of the libraries
+*/
+
+#include <string.h>
+#include "EthernetUdp.h"
+
+static EthernetUDP *sockets[SIM_UDP_SOCKETS];
+
+EthernetUDP::EthernetUDP() {
+  _port = 0;
+  sim_clear();
+}
+
+EthernetUDP::~EthernetUDP() {
+  int i;
+
+  for (i = 0; i < SIM_UDP_SOCKETS; i++) {
+    if (sockets[i] == this) sockets[i] = 0;
+  }
+}
+
+uint8_t EthernetUDP::begin(uint16_t port) {
+  int i, free_slot;
+
+  free_slot = -1;
+  for (i = 0; i < SIM_UDP_SOCKETS; i++) {
+    if (sockets[i] == this || (free_slot < 0 && sockets[i] == 0)) free_slot = i;
+    if (sockets[i] == this) break;
+  }
+  if (free_slot < 0) return 0;
+  sockets[free_slot] = this;
+  _port = port;
+  return 1;
+}
+
+// Whatever is left of the current datagram is discarded, as on the chip
+int EthernetUDP::parsePacket() {
+  _transfers++;
+  _cur.len = 0;
+  _curPos = 0;
+  if (_rxCount == 0) return 0;
+  _cur = _rx[_rxHead];
+  _rxHead = (_rxHead + 1) % SIM_UDP_QUEUE;
+  _rxCount--;
+  return _cur.len;
+}
+
+int EthernetUDP::available() {
+  return _cur.len - _curPos;
+}
+
+int EthernetUDP::read(unsigned char *buffer, size_t len) {
+  int n;
+
+  _transfers++;
+  n = available();
+  if (n == 0) return -1;
+  if ((size_t)n > len) n = len;
+  memcpy(buffer, _cur.data + _curPos, n);
+  _curPos += n;
+  return n;
+}
+
+int EthernetUDP::read(char *buffer, size_t len) {
+  return read((unsigned char *)buffer, len);
+}
+
+IPAddress EthernetUDP::remoteIP() {
+  return _cur.ip;
+}
+
+uint16_t EthernetUDP::remotePort() {
+  return _cur.port;
+}
+
+int EthernetUDP::beginPacket(IPAddress ip, uint16_t port) {
+  _transfers++;
+  _out.ip = ip;
+  _out.port = port;
+  _out.len = 0;
+  _building = true;
+  return 1;
+}
+
+// Bytes beyond SIM_UDP_MAX do not fit in the chip's buffer
+size_t EthernetUDP::write(const uint8_t *buffer, size_t size) {
+  size_t n;
+
+  _transfers++;
+  if (!_building) return 0;
+  n = SIM_UDP_MAX - _out.len;
+  if (size < n) n = size;
+  memcpy(_out.data + _out.len, buffer, n);
+  _out.len += n;
+  return n;
+}
+
+int EthernetUDP::endPacket() {
+  _transfers++;
+  if (!_building) return 0;
+  _building = false;
+  if (_failSends > 0) {
+    _failSends--;
+    return 0;
+  }
+  if (_txCount == SIM_UDP_QUEUE) {
+    // The oldest is lost, as if nobody was listening
+    _txHead = (_txHead + 1) % SIM_UDP_QUEUE;
+    _txCount--;
+  }
+  _tx[(_txHead + _txCount) % SIM_UDP_QUEUE] = _out;
+  _txCount++;
+  return 1;
+}
+
+bool EthernetUDP::sim_receive(IPAddress ip, uint16_t port, const uint8_t *data, int len) {
+  SimDatagram *d;
+
+  if (_rxCount == SIM_UDP_QUEUE || len < 0 || len > SIM_UDP_MAX) return false;
+  d = &_rx[(_rxHead + _rxCount) % SIM_UDP_QUEUE];
+  d->ip = ip;
+  d->port = port;
+  d->len = len;
+  memcpy(d->data, data, len);
+  _rxCount++;
+  return true;
+}
+
+int EthernetUDP::sim_received() {
+  return _rxCount;
+}
+
+int EthernetUDP::sim_sent(uint8_t *data, int capacity, IPAddress *ip, uint16_t *port) {
+  SimDatagram *d;
+  int n;
+
+  if (_txCount == 0) return -1;
+  d = &_tx[_txHead];
+  _txHead = (_txHead + 1) % SIM_UDP_QUEUE;
+  _txCount--;
+  n = d->len < capacity ? d->len : capacity;
+  memcpy(data, d->data, n);
+  if (ip) *ip = d->ip;
+  if (port) *port = d->port;
+  return d->len;
+}
+
+int EthernetUDP::sim_pending() {
+  return _txCount;
+}
+
+void EthernetUDP::sim_fail_sends(int count) {
+  _failSends = count;
+}
+
+unsigned long EthernetUDP::sim_transfers() {
+  return _transfers;
+}
+
+void EthernetUDP::sim_clear() {
+  _rxHead = 0;
+  _rxCount = 0;
+  _cur.len = 0;
+  _curPos = 0;
+  _txHead = 0;
+  _txCount = 0;
+  _building = false;
+  _failSends = 0;
+  _transfers = 0;
+}
+
+EthernetUDP *EthernetUDP::sim_socket(uint16_t port) {
+  int i;
+
+  for (i = 0; i < SIM_UDP_SOCKETS; i++) {
+    if (sockets[i] && sockets[i]->_port == port) return sockets[i];
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+  EthernetUdp.h - Simulated UDP socket for host builds of the libraries
+
+  A loopback stand-in for the W5x00, the test puts datagrams on the wire
+  for parsePacket() and takes back what the library sent.
+*/
+
+#ifndef EthernetUdp_h
+#define EthernetUdp_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "IPAddress.h"
+
+#define UDP_TX_PACKET_MAX_SIZE 24
+
+// Longest datagram and datagrams waiting each way
+#define SIM_UDP_MAX 128
+#define SIM_UDP_QUEUE 16
+// Sockets that can be begun at once
+#define SIM_UDP_SOCKETS 4
+
+struct SimDatagram {
+  IPAddress ip;
+  uint16_t port;
+  int len;
+  uint8_t data[SIM_UDP_MAX];
+};
+
+class EthernetUDP
+{
+  public:
+    EthernetUDP();
+    ~EthernetUDP();
+    uint8_t begin(uint16_t port);
+    int parsePacket();
+    int available();
+    int read(unsigned char *buffer, size_t len);
+    int read(char *buffer, size_t len);
+    IPAddress remoteIP();
+    uint16_t remotePort();
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const uint8_t *buffer, size_t size);
+    int endPacket();
+
+    // Simulator control
+    // Put a datagram on the wire for parsePacket(), false if the queue is full
+    bool sim_receive(IPAddress ip, uint16_t port, const uint8_t *data, int len);
+    int sim_received();
+    // Take the oldest datagram sent, its length or -1 if there is none
+    int sim_sent(uint8_t *data, int capacity, IPAddress *ip = 0, uint16_t *port = 0);
+    int sim_pending();
+    // Fail the next count sends, the datagram is lost
+    void sim_fail_sends(int count);
+    // Calls that would be SPI transfers to the chip
+    unsigned long sim_transfers();
+    void sim_clear();
+    // The socket begun on a port, 0 if there is none
+    static EthernetUDP *sim_socket(uint16_t port);
+
+  private:
+    uint16_t _port;
+    SimDatagram _rx[SIM_UDP_QUEUE];
+    int _rxHead;
+    int _rxCount;
+    SimDatagram _cur;
+    int _curPos;
+    SimDatagram _tx[SIM_UDP_QUEUE];
+    int _txHead;
+    int _txCount;
+    SimDatagram _out;
+    bool _building;
+    int _failSends;
+    unsigned long _transfers;
+};
+
+#endif
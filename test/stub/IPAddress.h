@@ -0,0 +1,24 @@
+/*
+  IPAddress.h - IPv4 address for host builds of the libraries
+*/
+
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+
+class IPAddress
+{
+  public:
+    IPAddress();
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+    uint8_t operator[](int i) const { return _addr[i]; }
+    uint8_t &operator[](int i) { return _addr[i]; }
+    bool operator==(const IPAddress &other) const;
+    bool operator!=(const IPAddress &other) const { return !(*this == other); }
+
+  private:
+    uint8_t _addr[4];
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+  sim.h - Control of the simulated Arduino core
+*/
+
+#ifndef sim_h
+#define sim_h
+
+#include "Arduino.h"
+
+// Number of pins on a Mega 2560
+#define SIM_PINS 70
+// Longest step the devices are advanced by in us
+#define SIM_STEP 10
+
+// Something attached to the pins that changes with time
+class SimDevice
+{
+  public:
+    virtual ~SimDevice() {}
+    virtual void step(double dt_us) = 0;
+};
+
+// Clear the clock, pins, interrupts and devices
+void sim_reset();
+void sim_add_device(SimDevice *device);
+
+// Virtual clock
+// Every core call takes some time, as it would on the target, so a loop
+// that polls the pins moves the clock on.
+unsigned long long sim_time_us();
+void sim_advance(unsigned long us);
+void sim_set_call_cost(unsigned int us);
+unsigned long sim_calls();
+
+// Pins as the devices see them
+void sim_drive(uint8_t pin, int level);
+int sim_output(uint8_t pin);
+int sim_pwm(uint8_t pin);
+unsigned long sim_pwm_writes(uint8_t pin);
+
+// Drives count encoder pulses onto pin at rate_hz, with a quadrature
+// channel on pin_b unless it is -1. A negative count runs in reverse.
+class SimPulseTrain : public SimDevice
+{
+  public:
+    SimPulseTrain(uint8_t pin, int pin_b, long count, unsigned long rate_hz);
+    void step(double dt_us);
+    bool done();
+    long sent;
+
+  private:
+    uint8_t _pin;
+    int _pin_b;
+    long _count;
+    double _quarter_us;
+    double _phase_us;
+    int _quarter;
+};
+
+// Interrupts
+bool sim_interrupts_enabled();
+unsigned long sim_interrupts_run();
+
+#endif
@@ -0,0 +1,55 @@
+/*
+  test.h - Checks for the host tests
+*/
+
+#ifndef test_h
+#define test_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    test_failures++; \
+  } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+  long long _a = (long long)(a), _b = (long long)(b); \
+  if (_a != _b) { \
+    printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+    test_failures++; \
+  } \
+} while (0)
+
+#define CHECK_NEAR(a, b, tol) do { \
+  double _a = (double)(a), _b = (double)(b); \
+  if (fabs(_a - _b) > (tol)) { \
+    printf("%s:%d: CHECK_NEAR(%s, %s, %s) failed, %g vs %g\n", __FILE__, __LINE__, #a, #b, #tol, _a, _b); \
+    test_failures++; \
+  } \
+} while (0)
+
+// CRC-8 as used for the motor calibration record
+static inline uint8_t test_crc8(const uint8_t *data, int len) {
+  uint8_t crc = 0;
+  int i, bit;
+
+  for (i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+// Report and give the exit status
+static inline int test_result(const char *name) {
+  printf("%s: %s\n", name, test_failures ? "FAIL" : "PASS");
+  return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+  test_backlash.cpp - Backlash measured by calibration and compensation
+  on reversing moves
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 2
+#define SENSOR_B 3
+#define LIMIT 24
+#define PULSES 3600
+#define BACKLASH 40
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// Calibrate with the quadrature ISR on a gear train with free play
+// Returns the backlash the calibration found in pulses.
+static int calibrate(Arduino_Motor &motor, Plant &plant) {
+  int count;
+
+  sim_add_device(&plant);
+  CHECK(motor.use_interrupts(SENSOR_B));
+  motor.set_speed(30);
+  motor.set_backoff_speed(20);
+  count = motor.calibrate();
+  // The free play must not come off the count between the switches
+  CHECK(abs(count - PULSES) <= 4);
+  return motor.backlash();
+}
+
+static void test_measure() {
+  const int lashes[] = { 0, BACKLASH, 2 * BACKLASH };
+  int i, found;
+
+  for (i = 0; i < 3; i++) {
+    sim_reset();
+    PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+    config.sensor_b = SENSOR_B;
+    config.backlash = lashes[i];
+    Plant plant(config);
+    Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+    found = calibrate(motor, plant);
+    printf("  backlash %2d pulses: calibration found %2d\n", lashes[i], found);
+    CHECK(abs(found - lashes[i]) <= 3);
+  }
+}
+
+// ------------------------------------
+// Worst output error over a run of reversing moves in cdeg
+// The moves follow one another at once so the coast of one is still
+// being counted when the next starts.
+static double reversals(bool comp) {
+  const long targets[] = { 12000, 10000, 12000, 9000, 11000, 10500 };
+  double err, worst;
+  int i;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.sensor_b = SENSOR_B;
+  config.backlash = BACKLASH;
+  Plant plant(config);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  // Compensate by what the calibration measured
+  calibrate(motor, plant);
+  motor.set_ramp(15, 8, 0);
+  motor.set_backlash_comp(comp);
+  worst = 0;
+  for (i = 0; i < 6; i++) {
+    CHECK(motor.move_to_position_cdeg(targets[i]));
+    // Let the output come to rest
+    delay(200);
+    err = plant.output * 36000.0 / PULSES - targets[i];
+    worst = max(worst, fabs(err));
+  }
+  printf("  backlash compensation %s: worst error %4.0f cdeg\n", comp ? "on " : "off", worst);
+  return worst;
+}
+
+static void test_compensation() {
+  double off = reversals(false);
+  double on = reversals(true);
+
+  // Without it each reversal is short by the backlash
+  CHECK(off > 0.8 * BACKLASH * 36000.0 / PULSES);
+  CHECK(on < off / 2);
+  // Only the short coast after ramping down is left, a coast counted
+  // against the next move would double it
+  CHECK(on < 100);
+}
+
+int main() {
+  test_measure();
+  test_compensation();
+  return test_result("test_backlash");
+}
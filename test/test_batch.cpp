@@ -0,0 +1,106 @@
+/*
+  test_batch.cpp - Event batching and coalescing in Arduino_UDP
+*/
+
+#include <string.h>
+#include "test.h"
+#include "sim.h"
+#include "arduino_udp.h"
+#include "arduino_udp_proto.h"
+
+#define CMD_PORT 8888
+#define EVNT_PORT 8889
+#define SUB_PORT 6000
+
+static byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xEE };
+static byte ip[] = { 192, 168, 1, 178 };
+
+// ------------------------------------
+// Events in order and one datagram per batch
+static void test_order() {
+  char event[UDP_EVENT_BATCH + 8];
+  uint8_t datagram[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+
+  sim_reset();
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  udp.subscribe(client, SUB_PORT, 0);
+  udp.setEventBatch(50);
+
+  udp.sendEvent((char *)"a;");
+  udp.sendEvent((char *)"b;");
+  CHECK_EQ(wire->sim_pending(), 0);
+
+  // Staged events go before one too long to stage
+  memset(event, 'L', sizeof(event));
+  CHECK(udp.sendEvent(event, UDP_EVENT_BATCH + 1));
+  CHECK_EQ(wire->sim_sent(datagram, sizeof(datagram)), 4);
+  CHECK(memcmp(datagram, "a;b;", 4) == 0);
+  CHECK_EQ(wire->sim_sent(datagram, sizeof(datagram)), UDP_EVENT_BATCH + 1);
+  CHECK_EQ(datagram[0], 'L');
+
+  // Then the interval
+  udp.sendEvent((char *)"c;");
+  sim_advance(49000);
+  udp.service();
+  CHECK_EQ(wire->sim_pending(), 0);
+  sim_advance(1000);
+  udp.service();
+  CHECK_EQ(wire->sim_sent(datagram, sizeof(datagram)), 2);
+  CHECK_EQ(udp.eventsSubmitted(), 4);
+  CHECK_EQ(udp.eventDatagrams(), 3);
+}
+
+// ------------------------------------
+// Only the latest status of each axis goes out
+static void test_coalesce() {
+  uint8_t datagram[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  ProtoStatus status;
+  ProtoFrame frame;
+  int length, at;
+  long seen[2];
+
+  sim_reset();
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  udp.subscribe(client, SUB_PORT, 0);
+  udp.setEventBatch(50);
+
+  status.state = 0;
+  status.fault = 0;
+  for (status.cdeg = 0; status.cdeg < 1000; status.cdeg += 100) {
+    status.axis = 0;
+    proto.sendEvent(&status);
+    status.axis = 1;
+    status.cdeg += 1;
+    proto.sendEvent(&status);
+    status.cdeg -= 1;
+  }
+  CHECK(udp.flushEvents());
+  length = wire->sim_sent(datagram, sizeof(datagram));
+  CHECK_EQ(wire->sim_pending(), 0);
+
+  seen[0] = seen[1] = -1;
+  for (at = 0; at < length; at += PROTO_HEADER_SIZE + frame.len) {
+    CHECK(Arduino_UDPProto::decode(datagram + at, PROTO_HEADER_SIZE + datagram[at + 3], &frame) >= 0);
+    CHECK(Arduino_UDPProto::getStatus(&frame, &status));
+    CHECK_EQ(seen[status.axis], -1);
+    seen[status.axis] = status.cdeg;
+  }
+  CHECK_EQ(at, length);
+  CHECK_EQ(seen[0], 900);
+  CHECK_EQ(seen[1], 901);
+  CHECK_EQ(udp.eventsSubmitted(), 20);
+  CHECK_EQ(udp.eventDatagrams(), 1);
+}
+
+int main() {
+  test_order();
+  test_coalesce();
+  return test_result("test_batch");
+}
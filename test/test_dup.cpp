@@ -0,0 +1,228 @@
+/*
+  test_dup.cpp - Retransmitted commands over a lossy link
+
+  A client sends numbered moves and retransmits until it has the reply.
+  The link loses requests and replies, duplicates requests and delivers
+  old ones late. Every move must run exactly once and every reply must
+  be the one from its run.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "arduino_udp.h"
+#include "arduino_udp_proto.h"
+
+#define CMD_PORT 8888
+#define EVNT_PORT 8889
+#define CLIENT_PORT 5000
+#define MOVES 2000
+
+static byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xEE };
+static byte ip[] = { 192, 168, 1, 178 };
+static int runs[MOVES + 1];
+static int total_runs;
+static int queries;
+
+static uint32_t rng_state;
+
+static uint32_t rng() {
+  rng_state = rng_state * 1664525UL + 1013904223UL;
+  return rng_state >> 8;
+}
+
+static bool chance(int percent) {
+  return (int)(rng() % 100) < percent;
+}
+
+// The reply fills the payload and carries the run number, so a reply
+// from a second run or for another move shows
+static int move(const ProtoFrame *request, byte *reply) {
+  int i;
+
+  runs[request->seq]++;
+  total_runs++;
+  for (i = 0; i < PROTO_MAX_PAYLOAD; i++) reply[i] = request->seq + i;
+  reply[0] = total_runs & 0xFF;
+  reply[1] = total_runs >> 8;
+  return PROTO_MAX_PAYLOAD;
+}
+
+static int query(const ProtoFrame *, byte *) {
+  queries++;
+  return 0;
+}
+
+static int encode_query(byte *buffer, unsigned int seq) {
+  ProtoFrame frame;
+
+  frame.opcode = PROTO_QUERY;
+  frame.seq = seq;
+  frame.len = 1;
+  frame.payload = buffer + PROTO_HEADER_SIZE;
+  frame.payload[0] = 0;
+  return Arduino_UDPProto::encode(buffer, PROTO_MAX_FRAME, &frame);
+}
+
+static int encode_move(byte *buffer, unsigned int seq) {
+  ProtoFrame frame;
+  ProtoMove move;
+
+  move.axis = 0;
+  move.cdeg = seq;
+  frame.opcode = PROTO_MOVE;
+  frame.seq = seq;
+  frame.payload = buffer + PROTO_HEADER_SIZE;
+  frame.len = Arduino_UDPProto::putMove(frame.payload, &move);
+  return Arduino_UDPProto::encode(buffer, PROTO_MAX_FRAME, &frame);
+}
+
+// ------------------------------------
+static void test_lossy_link(int loss, int dup, int late) {
+  byte request[PROTO_MAX_FRAME], reply[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  ProtoFrame frame;
+  unsigned int seq, old;
+  int length, i, result, tries, most_tries, first_run[MOVES + 1];
+  long duplicates, sent;
+  bool done;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_MOVE, move);
+  proto.trackClients(true);
+
+  memset(runs, 0, sizeof(runs));
+  memset(first_run, 0, sizeof(first_run));
+  total_runs = 0;
+  duplicates = 0;
+  sent = 0;
+  most_tries = 0;
+  for (seq = 1; seq <= MOVES; seq++) {
+    done = false;
+    for (tries = 0; !done && tries < 100; tries++) {
+      length = encode_move(request, seq);
+      if (!chance(loss)) wire->sim_receive(client, CLIENT_PORT, request, length);
+      if (chance(dup)) wire->sim_receive(client, CLIENT_PORT, request, length);
+      // An old retransmission turns up late
+      if (chance(late) && seq > 1) {
+        old = seq - 1 - rng() % min(seq - 1, 8U);
+        length = encode_move(request, old);
+        wire->sim_receive(client, CLIENT_PORT, request, length);
+      }
+      while ((result = proto.poll()) != 0) {
+        sent++;
+        if (result == PROTO_DUPLICATE) duplicates++;
+        else CHECK_EQ(result, PROTO_MOVE);
+      }
+      while ((length = wire->sim_sent(reply, sizeof(reply))) >= 0) {
+        if (chance(loss)) continue;
+        CHECK_EQ(Arduino_UDPProto::decode(reply, length, &frame), PROTO_MAX_PAYLOAD);
+        CHECK_EQ(frame.opcode, PROTO_MOVE | PROTO_REPLY);
+        for (i = 2; i < PROTO_MAX_PAYLOAD; i++) CHECK_EQ(frame.payload[i], (byte)(frame.seq + i));
+        // Every copy of a reply is the one from the first run
+        i = frame.payload[0] | (frame.payload[1] << 8);
+        if (first_run[frame.seq] == 0) first_run[frame.seq] = i;
+        CHECK_EQ(i, first_run[frame.seq]);
+        if (frame.seq == seq) done = true;
+      }
+    }
+    CHECK(done);
+    most_tries = max(most_tries, tries);
+  }
+
+  for (seq = 1; seq <= MOVES; seq++) CHECK_EQ(runs[seq], 1);
+  CHECK_EQ(total_runs, MOVES);
+  CHECK_EQ(proto.cacheMisses(), MOVES);
+  CHECK_EQ(proto.cacheHits() + proto.dropped(), duplicates);
+  CHECK_EQ(sent, MOVES + duplicates);
+  CHECK_EQ(proto.badFrames(), 0);
+  printf("  loss %2d%% dup %2d%% late %2d%%: %5ld requests, %5lu from the cache, %5lu dropped, at most %d tries\n",
+    loss, dup, late, sent, proto.cacheHits(), proto.dropped(), most_tries);
+}
+
+// ------------------------------------
+// Without tracking a retransmission runs again
+static void test_untracked() {
+  byte request[PROTO_MAX_FRAME], reply[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  int length;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_MOVE, move);
+
+  memset(runs, 0, sizeof(runs));
+  length = encode_move(request, 1);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  CHECK_EQ(proto.poll(), PROTO_MOVE);
+  CHECK_EQ(proto.poll(), PROTO_MOVE);
+  CHECK_EQ(runs[1], 2);
+  while (wire->sim_sent(reply, sizeof(reply)) >= 0);
+}
+
+// ------------------------------------
+// A client that restarts is not taken for one retransmitting
+static void test_restart() {
+  byte request[PROTO_MAX_FRAME], reply[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  ProtoFrame frame;
+  int length;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_MOVE, move);
+  proto.addHandler(PROTO_QUERY, query);
+  proto.trackClients(true);
+
+  memset(runs, 0, sizeof(runs));
+  queries = 0;
+  length = encode_move(request, 100);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  CHECK_EQ(proto.poll(), PROTO_MOVE);
+
+  // Another request under the same number
+  length = encode_query(request, 100);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  CHECK_EQ(proto.poll(), PROTO_QUERY);
+  CHECK_EQ(queries, 1);
+
+  // A late request from just behind is still dropped
+  length = encode_move(request, 100 - PROTO_SEQ_WINDOW + 1);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  CHECK_EQ(proto.poll(), PROTO_DUPLICATE);
+  CHECK_EQ(proto.dropped(), 1);
+
+  // Numbering again from the start, then a retransmission of that
+  length = encode_move(request, 1);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  wire->sim_receive(client, CLIENT_PORT, request, length);
+  CHECK_EQ(proto.poll(), PROTO_MOVE);
+  CHECK_EQ(proto.poll(), PROTO_DUPLICATE);
+  CHECK_EQ(proto.cacheHits(), 1);
+  CHECK_EQ(runs[1], 1);
+  CHECK_EQ(runs[100], 1);
+  CHECK_EQ(runs[100 - PROTO_SEQ_WINDOW + 1], 0);
+
+  // Every reply is for the request it answers
+  while ((length = wire->sim_sent(reply, sizeof(reply))) >= 0) {
+    CHECK(Arduino_UDPProto::decode(reply, length, &frame) >= 0);
+    CHECK(frame.opcode == (PROTO_MOVE | PROTO_REPLY) || frame.opcode == (PROTO_QUERY | PROTO_REPLY));
+  }
+}
+
+int main() {
+  rng_state = 1;
+  test_lossy_link(0, 0, 0);
+  test_lossy_link(20, 10, 0);
+  test_lossy_link(30, 30, 20);
+  test_untracked();
+  test_restart();
+  return test_result("test_dup");
+}
@@ -0,0 +1,156 @@
+/*
+  test_eeprom.cpp - Calibration record in EEPROM and restoring from it
+*/
+
+#include <unistd.h>
+#include <EEPROM.h>
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+#define ADDR 16
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// Rewrite one byte of the record, optionally keeping the CRC good
+static void patch(int offset, uint8_t val, bool fix_crc) {
+  uint8_t rec[MOTOR_EE_SIZE];
+  int i;
+
+  for (i = 0; i < MOTOR_EE_SIZE; i++) rec[i] = EEPROM.read(ADDR + i);
+  rec[offset] = val;
+  if (fix_crc) rec[MOTOR_EE_SIZE - 1] = test_crc8(rec, MOTOR_EE_SIZE - 1);
+  for (i = 0; i < MOTOR_EE_SIZE; i++) EEPROM.write(ADDR + i, rec[i]);
+}
+
+// ------------------------------------
+// Records that must not load
+static void test_rejected() {
+  uint8_t good[MOTOR_EE_SIZE];
+  int i;
+
+  sim_reset();
+  EEPROM.sim_erase();
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+  Arduino_Motor other(0, no_event, DIR, PWM, SENSOR, LIMIT, 90);
+
+  // Nothing saved yet
+  CHECK(!motor.load_cal(ADDR));
+  // Not calibrated, nothing to save
+  CHECK(!motor.save_cal(ADDR));
+  // No count to scale by
+  CHECK(!motor.set_cal(0));
+  CHECK(!motor.save_cal(ADDR));
+  CHECK(motor.set_cal(PULSES));
+  motor.set_backlash(12);
+  CHECK(motor.save_cal(ADDR));
+  for (i = 0; i < MOTOR_EE_SIZE; i++) good[i] = EEPROM.read(ADDR + i);
+  CHECK(motor.load_cal(ADDR));
+  CHECK_EQ(motor.backlash(), 12);
+
+  // Only changed bytes are written
+  i = EEPROM.sim_writes();
+  CHECK(motor.save_cal(ADDR));
+  CHECK_EQ(EEPROM.sim_writes(), i);
+
+  // A different span
+  CHECK(!other.load_cal(ADDR));
+
+  // Another layout
+  patch(0, good[0] + 1, true);
+  CHECK(!motor.load_cal(ADDR));
+  patch(0, good[0], true);
+  CHECK(motor.load_cal(ADDR));
+
+  // A zero pulse count
+  patch(1, 0, true);
+  patch(2, 0, true);
+  CHECK(!motor.load_cal(ADDR));
+  patch(1, good[1], true);
+  patch(2, good[2], true);
+  CHECK(motor.load_cal(ADDR));
+
+  // Corrupted, each byte in turn
+  for (i = 0; i < MOTOR_EE_SIZE; i++) {
+    patch(i, good[i] ^ 0x10, false);
+    CHECK(!motor.load_cal(ADDR));
+    patch(i, good[i], false);
+  }
+  CHECK(motor.load_cal(ADDR));
+}
+
+// ------------------------------------
+// Power off away from home and restore on the next start
+// moved is how far the output was turned by hand while off, in pulses.
+static bool restart(const char *path, double moved, int *fault, double *home_error) {
+  bool restored;
+
+  // First run, move and save
+  {
+    sim_reset();
+    EEPROM.sim_erase();
+    CHECK(EEPROM.sim_file(path));
+    PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+    config.start = 0;
+    Plant plant(config);
+    Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+    sim_add_device(&plant);
+    motor.set_cal(PULSES);
+    motor.set_speed(60);
+    motor.set_closed_loop(true);
+    CHECK(motor.move_to_position(120));
+    CHECK(motor.save_cal(ADDR));
+    // Lose the RAM copy, keep the file
+    CHECK(EEPROM.sim_file(0));
+    EEPROM.sim_erase();
+  }
+
+  // Second run from the file
+  sim_reset();
+  CHECK(EEPROM.sim_file(path));
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 1200 + moved;
+  Plant plant(config);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  motor.set_speed(60);
+  restored = motor.restore_cal(ADDR, 40);
+  *fault = motor.fault();
+  *home_error = plant.output;
+  CHECK(EEPROM.sim_file(0));
+  return restored;
+}
+
+static void test_restore() {
+  char path[64];
+  int fault;
+  double home_error;
+
+  snprintf(path, sizeof(path), "/tmp/test_eeprom_%d.bin", (int)getpid());
+
+  // Where it was left
+  CHECK(restart(path, 0, &fault, &home_error));
+  CHECK_EQ(fault, MOTOR_FAULT_NONE);
+  CHECK(fabs(home_error) < 40);
+
+  // Turned by hand while off
+  CHECK(!restart(path, 300, &fault, &home_error));
+  CHECK_EQ(fault, MOTOR_FAULT_POSITION);
+
+  unlink(path);
+}
+
+int main() {
+  test_rejected();
+  test_restore();
+  return test_result("test_eeprom");
+}
@@ -0,0 +1,107 @@
+/*
+  test_encoder.cpp - Interrupt driven encoder counting
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 2
+#define SENSOR_B 3
+#define LIMIT 24
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// Pulse trains straight onto the interrupt pins
+static void test_pulse_trains() {
+  long counts[] = { 20000, -5000, 100 };
+  unsigned long rates[] = { 20000, 50000, 100 };
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    sim_reset();
+    Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+    SimPulseTrain train(SENSOR, SENSOR_B, counts[i], rates[i]);
+
+    CHECK(motor.use_interrupts(SENSOR_B));
+    sim_add_device(&train);
+    // The sketch keeps reading the count while the pulses arrive
+    while (!train.done()) {
+      motor.encoder_count();
+      delayMicroseconds(3);
+    }
+    CHECK_EQ(motor.encoder_count(), counts[i]);
+  }
+}
+
+// ------------------------------------
+// Without the second channel every pulse counts up
+static void test_single_channel() {
+  sim_reset();
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+  SimPulseTrain train(SENSOR, -1, -3000, 10000);
+
+  CHECK(motor.use_interrupts());
+  sim_add_device(&train);
+  while (!train.done()) {
+    motor.encoder_count();
+    delayMicroseconds(3);
+  }
+  CHECK_EQ(motor.encoder_count(), 3000);
+}
+
+// ------------------------------------
+// Pins without an interrupt are refused
+static void test_not_an_interrupt() {
+  sim_reset();
+  Arduino_Motor motor(0, no_event, DIR, PWM, 30, LIMIT, 360);
+
+  CHECK(!motor.use_interrupts());
+}
+
+// ------------------------------------
+// Calibrate on a slow loop
+// Returns the pulse count between the switches.
+static int calibrate(bool isr, int duty) {
+  int count;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.sensor_b = SENSOR_B;
+  Plant plant(config);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  if (isr) CHECK(motor.use_interrupts(SENSOR_B));
+  motor.set_speed(duty);
+  motor.set_backoff_speed(40);
+  // Each core call as slow as a busy sketch
+  sim_set_call_cost(40);
+  count = motor.calibrate();
+  printf("  %s at %d%%: %d pulses\n", isr ? "interrupts" : "polled", duty, count);
+  // Every pulse the encoder gave was counted
+  if (isr) CHECK_EQ(motor.encoder_count(), plant.edges);
+  return count;
+}
+
+static void test_full_speed() {
+  int isr, polled;
+
+  isr = calibrate(true, 100);
+  polled = calibrate(false, 100);
+  CHECK(isr > 3400);
+  // Polling misses pulses at this speed
+  CHECK(polled < isr - 100);
+}
+
+int main() {
+  test_pulse_trains();
+  test_single_channel();
+  test_not_an_interrupt();
+  test_full_speed();
+  return test_result("test_encoder");
+}
@@ -0,0 +1,50 @@
+/*
+  test_events.cpp - Position events during moves
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+
+static int events;
+static int moving_events;
+static Arduino_Motor *event_motor;
+
+static void count_event(int) {
+  events++;
+  if (event_motor->busy()) moving_events++;
+}
+
+// ------------------------------------
+// The first event goes even when it is at degree 0
+static void test_first_event() {
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 0;
+  Plant plant(config);
+  Arduino_Motor motor(0, count_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  event_motor = &motor;
+  events = 0;
+  moving_events = 0;
+  sim_add_device(&plant);
+  motor.set_cal(PULSES);
+  motor.set_speed(20);
+  motor.set_closed_loop(true);
+  // Stays within degree 0
+  CHECK(motor.move_to_position_cdeg(30));
+  CHECK_EQ(motor.position(), 0);
+  CHECK_EQ(moving_events, 1);
+  CHECK_EQ(events, 2);
+}
+
+int main() {
+  test_first_event();
+  return test_result("test_events");
+}
@@ -0,0 +1,120 @@
+/*
+  test_multi.cpp - Coordinated moves of azimuth and elevation
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "arduino_multi_motor.h"
+#include "plant.h"
+
+// Pins as in the sketch
+#define AZ_DIR 22
+#define AZ_PWM 4
+#define AZ_SENSOR 30
+#define AZ_LIMIT 24
+#define AZ_PULSES 3600
+#define EL_DIR 23
+#define EL_PWM 5
+#define EL_SENSOR 31
+#define EL_LIMIT_FWD 25
+#define EL_LIMIT_REV 26
+#define EL_PULSES 1200
+
+static int events;
+
+static void no_event(int) {
+}
+
+static void count_events(long *, int) {
+  events++;
+}
+
+struct SlewResult {
+  double total_ms;      // Until both axes stop
+  double az_ms;         // Until each axis stops
+  double el_ms;
+  double az_err;        // Output position less the target in cdeg
+  double el_err;
+  int most_events;      // Most events from one update()
+};
+
+// ------------------------------------
+// Slew from home to the target one axis after the other or together
+static SlewResult slew(bool together, long az_cdeg, long el_cdeg) {
+  SlewResult result;
+  unsigned long long start;
+  long target[2] = { az_cdeg, el_cdeg };
+  int before;
+
+  sim_reset();
+  PlantConfig az_config = plant_az(AZ_DIR, AZ_PWM, AZ_SENSOR, AZ_LIMIT);
+  az_config.start = 0;
+  PlantConfig el_config = plant_el(EL_DIR, EL_PWM, EL_SENSOR, EL_LIMIT_FWD, EL_LIMIT_REV);
+  el_config.start = 0;
+  Plant az_plant(az_config);
+  Plant el_plant(el_config);
+  Arduino_Motor az(0, no_event, AZ_DIR, AZ_PWM, AZ_SENSOR, AZ_LIMIT, 360);
+  Arduino_Motor el(1, no_event, EL_DIR, EL_PWM, EL_SENSOR, EL_LIMIT_FWD, EL_LIMIT_REV, 90);
+  Arduino_MultiMotor multi(count_events);
+
+  sim_add_device(&az_plant);
+  sim_add_device(&el_plant);
+  az.set_speed(60);
+  el.set_speed(60);
+  az.set_backoff_speed(40);
+  el.set_backoff_speed(40);
+  // Calibration builds the speed maps the move is planned with
+  CHECK(az.calibrate() > 0);
+  CHECK(el.calibrate() > 0);
+  az.set_closed_loop(true);
+  el.set_closed_loop(true);
+  CHECK(multi.add(&az));
+  CHECK(multi.add(&el));
+
+  events = 0;
+  result.most_events = 0;
+  result.az_ms = 0;
+  result.el_ms = 0;
+  start = sim_time_us();
+  if (together) {
+    CHECK(multi.start_move_to_position(target));
+    do {
+      before = events;
+      multi.update();
+      result.most_events = max(result.most_events, events - before);
+      if (result.az_ms == 0 && !az.busy()) result.az_ms = (sim_time_us() - start) / 1000.0;
+      if (result.el_ms == 0 && !el.busy()) result.el_ms = (sim_time_us() - start) / 1000.0;
+    } while (multi.busy());
+    CHECK_EQ(multi.state(), MOTOR_DONE);
+  } else {
+    CHECK(az.move_to_position_cdeg(az_cdeg));
+    result.az_ms = (sim_time_us() - start) / 1000.0;
+    CHECK(el.move_to_position_cdeg(el_cdeg));
+    result.el_ms = (sim_time_us() - start) / 1000.0;
+  }
+  result.total_ms = (sim_time_us() - start) / 1000.0;
+  result.az_err = az_plant.output * 36000.0 / AZ_PULSES - az_cdeg;
+  result.el_err = el_plant.output * 9000.0 / EL_PULSES - el_cdeg;
+  printf("  %s: %6.0f ms, az stops at %6.0f ms error %4.0f cdeg, el stops at %6.0f ms error %4.0f cdeg\n",
+    together ? "together  " : "one by one", result.total_ms, result.az_ms, result.az_err, result.el_ms, result.el_err);
+  return result;
+}
+
+// ------------------------------------
+// Moving together is quicker and both axes arrive at about the same time
+static void test_slew_time() {
+  SlewResult one = slew(false, 18000, 4500);
+  SlewResult both = slew(true, 18000, 4500);
+
+  CHECK(both.total_ms < 0.8 * one.total_ms);
+  CHECK(fabs(both.az_ms - both.el_ms) < 0.25 * both.total_ms);
+  CHECK(fabs(both.az_err) <= 30);
+  CHECK(fabs(both.el_err) <= 30);
+  // One event per update, the final one included
+  CHECK_EQ(both.most_events, 1);
+}
+
+int main() {
+  test_slew_time();
+  return test_result("test_multi");
+}
@@ -0,0 +1,125 @@
+/*
+  test_pid.cpp - Closed loop moves on the simulated plant
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+
+static void no_event(int) {
+}
+
+// Highest PWM the motor is given
+class PwmPeak : public SimDevice
+{
+  public:
+    PwmPeak() : peak(0) {}
+    void step(double) { peak = max(peak, sim_pwm(PWM)); }
+    int peak;
+};
+
+struct MoveResult {
+  double settle_ms;
+  double error_cdeg;    // Target less where the output really is
+  int peak_pwm;
+};
+
+// ------------------------------------
+// Move from the middle of the travel to each target in turn
+static void moves(bool closed, const long *targets, int n, MoveResult *results) {
+  unsigned long long start;
+  int i;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  Plant plant(config);
+  PwmPeak pwm;
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  sim_add_device(&pwm);
+  motor.set_cal(PULSES);
+  // set_cal() takes the current position as home
+  plant.output = plant.motor = 0;
+  motor.set_speed(60);
+  motor.set_closed_loop(closed);
+  motor.set_pid(256, 8, 512);
+  motor.set_deadband(2);
+  motor.set_pwm_limit(15, 60);
+  for (i = 0; i < n; i++) {
+    pwm.peak = 0;
+    start = sim_time_us();
+    CHECK(motor.move_to_position_cdeg(targets[i]));
+    // Let an open loop move coast to rest
+    delay(200);
+    results[i].settle_ms = (sim_time_us() - start) / 1000.0 - 200;
+    results[i].error_cdeg = targets[i] - plant.output * 36000.0 / PULSES;
+    results[i].peak_pwm = pwm.peak;
+    printf("  %s to %5ld cdeg: %6.0f ms, error %5.0f cdeg, peak PWM %d\n", closed ? "closed" : "open  ",
+      targets[i], results[i].settle_ms, results[i].error_cdeg, results[i].peak_pwm);
+  }
+}
+
+static void test_settling() {
+  const long targets[] = { 9000, 4550, 27000, 26990, 0 };
+  MoveResult open[5], closed[5];
+  double open_err, closed_err;
+  int i;
+
+  moves(false, targets, 5, open);
+  moves(true, targets, 5, closed);
+  open_err = 0;
+  closed_err = 0;
+  for (i = 0; i < 5; i++) {
+    open_err = max(open_err, fabs(open[i].error_cdeg));
+    closed_err = max(closed_err, fabs(closed[i].error_cdeg));
+    // Within the deadband and a pulse of rounding
+    CHECK(fabs(closed[i].error_cdeg) <= 3 * 36000.0 / PULSES);
+    // Settles promptly
+    CHECK(closed[i].settle_ms < 3000);
+    // The output is limited
+    CHECK(closed[i].peak_pwm <= (int)(0.60 * 255));
+  }
+  printf("  worst error open %.0f cdeg, closed %.0f cdeg\n", open_err, closed_err);
+  // Open loop coasts past the target
+  CHECK(open_err > 2 * closed_err);
+}
+
+// ------------------------------------
+// Without a PWM limit the closed loop keeps to the set speed
+static void test_speed_limit() {
+  const long targets[] = { 27000, 4550, 0 };
+  int i;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  Plant plant(config);
+  PwmPeak pwm;
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  sim_add_device(&pwm);
+  motor.set_cal(PULSES);
+  plant.output = plant.motor = 0;
+  motor.set_speed(40);
+  motor.set_closed_loop(true);
+  for (i = 0; i < 3; i++) {
+    CHECK(motor.move_to_position_cdeg(targets[i]));
+    CHECK(fabs(targets[i] - plant.output * 36000.0 / PULSES) <= 3 * 36000.0 / PULSES);
+  }
+  printf("  closed at 40%%: peak PWM %d\n", pwm.peak);
+  CHECK(pwm.peak > 0);
+  CHECK(pwm.peak <= (int)(0.40 * 255));
+}
+
+int main() {
+  test_settling();
+  test_speed_limit();
+  return test_result("test_pid");
+}
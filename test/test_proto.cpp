@@ -0,0 +1,267 @@
+/*
+  test_proto.cpp - Framing and dispatch of the binary command protocol
+*/
+
+#include <string.h>
+#include "test.h"
+#include "arduino_udp.h"
+#include "arduino_udp_proto.h"
+
+#define CMD_PORT 8888
+#define EVNT_PORT 8889
+#define CLIENT_PORT 5000
+
+static byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xEE };
+static byte ip[] = { 192, 168, 1, 178 };
+static int queries;
+
+// Repeatable pseudo random numbers for the fuzzing
+static uint32_t rng_state;
+
+static uint32_t rng() {
+  rng_state = rng_state * 1664525UL + 1013904223UL;
+  return rng_state >> 8;
+}
+
+static int query(const ProtoFrame *, byte *) {
+  queries++;
+  return 0;
+}
+
+// Whether a frame of length bytes is one the decoder should take
+static bool well_formed(const byte *buffer, int length) {
+  return length >= PROTO_HEADER_SIZE && buffer[3] <= PROTO_MAX_PAYLOAD && PROTO_HEADER_SIZE + buffer[3] == length;
+}
+
+// Fill a buffer with a frame, valid or mangled
+static int make_frame(byte *buffer, int capacity) {
+  int length, i;
+
+  for (i = 0; i < capacity; i++) buffer[i] = rng();
+  length = rng() % (PROTO_MAX_FRAME + 8);
+  switch (rng() % 4) {
+  case 0:
+    // Noise
+    break;
+  case 1:
+    // Valid
+    buffer[3] = rng() % (PROTO_MAX_PAYLOAD + 1);
+    length = PROTO_HEADER_SIZE + buffer[3];
+    break;
+  case 2:
+    // Valid then cut short or run on
+    buffer[3] = rng() % (PROTO_MAX_PAYLOAD + 1);
+    length = PROTO_HEADER_SIZE + buffer[3] + (int)(rng() % 9) - 4;
+    if (length < 0) length = 0;
+    break;
+  default:
+    // Valid with the length byte flipped
+    buffer[3] = rng() % (PROTO_MAX_PAYLOAD + 1);
+    length = PROTO_HEADER_SIZE + buffer[3];
+    buffer[3] ^= 1 << (rng() % 8);
+    break;
+  }
+  if (length > capacity) length = capacity;
+  return length;
+}
+
+// ------------------------------------
+// Encode then decode every payload length
+static void test_round_trip() {
+  byte payload[PROTO_MAX_PAYLOAD + 1], buffer[PROTO_MAX_FRAME];
+  ProtoFrame frame, back;
+  int len, length;
+
+  rng_state = 1;
+  for (len = 0; len <= PROTO_MAX_PAYLOAD + 1; len++) {
+    for (length = 0; length < len; length++) payload[length] = rng();
+    frame.opcode = rng();
+    frame.seq = rng() & 0xFFFF;
+    frame.len = len;
+    frame.payload = payload;
+    length = Arduino_UDPProto::encode(buffer, sizeof(buffer), &frame);
+    if (len > PROTO_MAX_PAYLOAD) {
+      CHECK_EQ(length, -1);
+      continue;
+    }
+    CHECK_EQ(length, PROTO_HEADER_SIZE + len);
+    CHECK_EQ(Arduino_UDPProto::decode(buffer, length, &back), len);
+    CHECK_EQ(back.opcode, frame.opcode);
+    CHECK_EQ(back.seq, frame.seq);
+    CHECK(memcmp(back.payload, payload, len) == 0);
+    // Never beyond the capacity given
+    CHECK_EQ(Arduino_UDPProto::encode(buffer, length - 1, &frame), -1);
+  }
+}
+
+// ------------------------------------
+// Typed payloads only from frames of their exact length
+static void test_typed() {
+  byte buffer[PROTO_MAX_FRAME];
+  ProtoFrame frame;
+  ProtoMove move, move_back;
+  ProtoStatus status, status_back;
+  byte axis;
+  const long values[] = { 0, 1, -1, 36000, -36000, 2147483647L, -2147483647L - 1 };
+  int i;
+
+  frame.payload = buffer;
+  for (i = 0; i < 7; i++) {
+    move.axis = i;
+    move.cdeg = values[i];
+    frame.len = Arduino_UDPProto::putMove(buffer, &move);
+    CHECK(Arduino_UDPProto::getMove(&frame, &move_back));
+    CHECK_EQ(move_back.axis, i);
+    CHECK_EQ(move_back.cdeg, values[i]);
+
+    status.axis = i;
+    status.state = i + 1;
+    status.fault = i + 2;
+    status.cdeg = values[i];
+    frame.len = Arduino_UDPProto::putStatus(buffer, &status);
+    CHECK(Arduino_UDPProto::getStatus(&frame, &status_back));
+    CHECK_EQ(status_back.state, i + 1);
+    CHECK_EQ(status_back.fault, i + 2);
+    CHECK_EQ(status_back.cdeg, values[i]);
+  }
+  for (i = 0; i <= PROTO_MAX_PAYLOAD; i++) {
+    frame.len = i;
+    CHECK(Arduino_UDPProto::getAxis(&frame, &axis) == (i == 1));
+    CHECK(Arduino_UDPProto::getMove(&frame, &move) == (i == 5));
+    CHECK(Arduino_UDPProto::getStatus(&frame, &status) == (i == 7));
+  }
+}
+
+// ------------------------------------
+// Random and mangled frames, each in a buffer of exactly its length so a
+// read past the end shows under a memory checker
+static void test_decode_fuzz() {
+  byte frame_buffer[PROTO_MAX_FRAME + 8];
+  byte *buffer;
+  ProtoFrame frame;
+  int n, length, len;
+  long accepted, rejected;
+
+  rng_state = 2;
+  accepted = 0;
+  rejected = 0;
+  for (n = 0; n < 200000; n++) {
+    length = make_frame(frame_buffer, sizeof(frame_buffer));
+    buffer = (byte *)malloc(length > 0 ? length : 1);
+    memcpy(buffer, frame_buffer, length);
+    len = Arduino_UDPProto::decode(buffer, length, &frame);
+    if (well_formed(frame_buffer, length)) {
+      accepted++;
+      CHECK_EQ(len, frame_buffer[3]);
+      CHECK(frame.payload == buffer + PROTO_HEADER_SIZE);
+      CHECK_EQ(frame.opcode, frame_buffer[0]);
+      CHECK_EQ(frame.seq, frame_buffer[1] | (frame_buffer[2] << 8));
+    } else {
+      rejected++;
+      CHECK_EQ(len, -1);
+    }
+    free(buffer);
+  }
+  CHECK(accepted > 10000);
+  CHECK(rejected > 10000);
+}
+
+// ------------------------------------
+// Datagrams through poll(), only well formed frames reach a handler
+static void test_poll_fuzz() {
+  byte frame_buffer[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  int n, length, result;
+  long good, bad;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_QUERY, query);
+
+  rng_state = 3;
+  queries = 0;
+  good = 0;
+  bad = 0;
+  for (n = 0; n < 20000; n++) {
+    length = make_frame(frame_buffer, sizeof(frame_buffer));
+    // Sometimes a valid frame followed by more bytes
+    if (rng() % 8 == 0) {
+      frame_buffer[3] = rng() % (PROTO_MAX_PAYLOAD + 1);
+      length = PROTO_HEADER_SIZE + frame_buffer[3] + 1 + rng() % 64;
+    }
+    if (length == 0) continue;
+    frame_buffer[0] = PROTO_QUERY;
+    wire->sim_receive(client, CLIENT_PORT, frame_buffer, length);
+    result = proto.poll();
+    if (well_formed(frame_buffer, length)) {
+      good++;
+      CHECK_EQ(result, PROTO_QUERY);
+      CHECK_EQ(wire->sim_pending(), 1);
+    } else {
+      bad++;
+      CHECK_EQ(result, -1);
+      CHECK_EQ(wire->sim_pending(), 0);
+    }
+    while (wire->sim_sent(frame_buffer, sizeof(frame_buffer)) >= 0);
+  }
+  CHECK_EQ(queries, good);
+  CHECK_EQ(proto.badFrames(), bad);
+  CHECK_EQ(proto.poll(), 0);
+}
+
+// ------------------------------------
+// A valid frame at the start of a longer datagram is not run
+static void test_oversized() {
+  byte datagram[SIM_UDP_MAX], reply[SIM_UDP_MAX];
+  IPAddress client(192, 168, 1, 10);
+  ProtoFrame frame;
+  int length, extra;
+
+  Arduino_UDP udp(CMD_PORT, EVNT_PORT);
+  Arduino_UDPProto proto(&udp);
+  udp.begin(mac, ip);
+  EthernetUDP *wire = EthernetUDP::sim_socket(CMD_PORT);
+  proto.addHandler(PROTO_QUERY, query);
+
+  queries = 0;
+  memset(datagram, 0, sizeof(datagram));
+  frame.opcode = PROTO_QUERY;
+  frame.seq = 1;
+  frame.len = PROTO_MAX_PAYLOAD;
+  frame.payload = datagram + PROTO_HEADER_SIZE;
+  length = Arduino_UDPProto::encode(datagram, sizeof(datagram), &frame);
+  CHECK_EQ(length, PROTO_MAX_FRAME);
+
+  // The longest frame is fine
+  wire->sim_receive(client, CLIENT_PORT, datagram, length);
+  CHECK_EQ(proto.poll(), PROTO_QUERY);
+  CHECK_EQ(queries, 1);
+  CHECK(wire->sim_sent(reply, sizeof(reply)) >= 0);
+
+  for (extra = 1; extra <= SIM_UDP_MAX - length; extra *= 2) {
+    wire->sim_receive(client, CLIENT_PORT, datagram, length + extra);
+    CHECK_EQ(proto.poll(), -1);
+  }
+  CHECK_EQ(queries, 1);
+  CHECK_EQ(wire->sim_pending(), 0);
+  CHECK_EQ(proto.badFrames(), 7);
+
+  // The excess does not turn up as the next request
+  frame.len = 0;
+  length = Arduino_UDPProto::encode(datagram, sizeof(datagram), &frame);
+  wire->sim_receive(client, CLIENT_PORT, datagram, length);
+  CHECK_EQ(proto.poll(), PROTO_QUERY);
+  CHECK_EQ(queries, 2);
+  CHECK_EQ(proto.poll(), 0);
+}
+
+int main() {
+  test_round_trip();
+  test_typed();
+  test_decode_fuzz();
+  test_poll_fuzz();
+  test_oversized();
+  return test_result("test_proto");
+}
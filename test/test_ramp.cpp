@@ -0,0 +1,122 @@
+/*
+  test_ramp.cpp - PWM sequence of ramped moves
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+#define LOG_LEN 512
+
+static void no_event(int) {
+}
+
+// Records each PWM the motor is given
+class PwmLog : public SimDevice
+{
+  public:
+    PwmLog() : len(0), last(0) {}
+    void step(double) {
+      int pwm = sim_pwm(PWM);
+      if (pwm != last && len < LOG_LEN) log[len++] = pwm;
+      last = pwm;
+    }
+    int log[LOG_LEN];
+    int len;
+    int last;
+};
+
+// ------------------------------------
+// Run a move and check the PWM rises to a peak and falls back
+// Returns the peak PWM.
+// The steps at the start and end of the acceleration are compared with one
+// in the middle.
+static int ramped_move(int deg, int jerk, int *first_step, int *last_step, int *mid_step) {
+  int i, peak, top;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 0;
+  Plant plant(config);
+  PwmLog pwm;
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  sim_add_device(&pwm);
+  motor.set_cal(PULSES);
+  motor.set_speed(60);
+  motor.set_ramp(15, 8, jerk);
+  CHECK(motor.move_to_position(deg));
+
+  // Starts at the start duty and ends stopped
+  CHECK(pwm.len > 2);
+  CHECK_EQ(pwm.log[0], (int)(0.15 * 255));
+  CHECK_EQ(pwm.log[pwm.len - 1], 0);
+  // Up to the peak and down again, no step back on the way
+  for (top = 0; top < pwm.len - 1 && pwm.log[top + 1] > pwm.log[top]; top++);
+  for (i = top; i < pwm.len - 1; i++) CHECK(pwm.log[i + 1] < pwm.log[i]);
+  peak = pwm.log[top];
+  *first_step = pwm.log[1] - pwm.log[0];
+  *last_step = (top > 0) ? pwm.log[top] - pwm.log[top - 1] : 0;
+  *mid_step = (top > 6) ? pwm.log[6] - pwm.log[5] : 0;
+  printf("  %3d deg jerk %d: %d PWM changes, peak %d\n", deg, jerk, pwm.len, peak);
+  return peak;
+}
+
+static void test_long_move() {
+  int first, last, mid;
+
+  // Reaches the set speed
+  CHECK_EQ(ramped_move(180, 0, &first, &last, &mid), (int)(0.60 * 255));
+  // Trapezoid, constant acceleration
+  CHECK(mid > 0);
+  CHECK_EQ(first, mid);
+}
+
+static void test_short_move() {
+  int first, last, mid;
+
+  // Turns round before reaching the set speed
+  CHECK(ramped_move(2, 0, &first, &last, &mid) < (int)(0.60 * 255));
+}
+
+static void test_s_curve() {
+  int first, last, mid;
+
+  CHECK_EQ(ramped_move(180, 1, &first, &last, &mid), (int)(0.60 * 255));
+  // The acceleration builds up then eases off into the top speed
+  CHECK(first < mid);
+  CHECK(last < mid);
+}
+
+// ------------------------------------
+// Without a ramp the move starts and ends at the set speed
+static void test_no_ramp() {
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 0;
+  Plant plant(config);
+  PwmLog pwm;
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  sim_add_device(&pwm);
+  motor.set_cal(PULSES);
+  motor.set_speed(60);
+  CHECK(motor.move_to_position(90));
+  CHECK_EQ(pwm.len, 2);
+  CHECK_EQ(pwm.log[0], (int)(0.60 * 255));
+}
+
+int main() {
+  test_long_move();
+  test_short_move();
+  test_s_curve();
+  test_no_ramp();
+  return test_result("test_ramp");
+}
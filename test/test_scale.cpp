@@ -0,0 +1,103 @@
+/*
+  test_scale.cpp - Q16 conversions between pulses and centidegrees
+*/
+
+#include <math.h>
+#include <EEPROM.h>
+#include "test.h"
+#include "arduino_motor.h"
+#include "sim.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// Put the motor at a position by loading a calibration record
+static bool load_position(Arduino_Motor &motor, int num_pulses, long position) {
+  uint8_t rec[MOTOR_EE_SIZE];
+  int i;
+
+  motor.set_cal(num_pulses);
+  if (!motor.save_cal(0)) return false;
+  for (i = 0; i < MOTOR_EE_SIZE; i++) rec[i] = EEPROM.read(i);
+  for (i = 0; i < 4; i++) rec[5 + i] = (uint8_t)(((unsigned long)position >> (8 * i)) & 0xFF);
+  rec[MOTOR_EE_SIZE - 1] = test_crc8(rec, MOTOR_EE_SIZE - 1);
+  for (i = 0; i < MOTOR_EE_SIZE; i++) EEPROM.write(i, rec[i]);
+  return motor.load_cal(0);
+}
+
+// ------------------------------------
+// Pulses to centidegrees across the span and the overtravel either side
+static void test_pulses_to_cdeg() {
+  const int spans[] = { 90, 360, 450, 600, 655 };
+  const int pulses[] = { 7, 1000, 3600, 32767 };
+  int s, n;
+  long p, limit, step;
+  double exact, err, worst;
+
+  for (s = 0; s < 5; s++) {
+    for (n = 0; n < 4; n++) {
+      sim_reset();
+      EEPROM.sim_erase();
+      Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, spans[s]);
+
+      limit = pulses[n] + pulses[n] / 2;
+      step = max(1L, limit / 500);
+      worst = 0;
+      for (p = -limit; p <= limit; p += step) {
+        CHECK(load_position(motor, pulses[n], p));
+        exact = (double)p * spans[s] * 100 / pulses[n];
+        err = motor.position_cdeg() - exact;
+        worst = max(worst, fabs(err));
+      }
+      // Rounding of the factor and the result, never an overflow
+      if (worst > 1.0) printf("  span %d, %d pulses: worst error %.2f cdeg\n", spans[s], pulses[n], worst);
+      CHECK(worst <= 1.0);
+
+      // Clamped beyond the overtravel
+      exact = (double)limit * spans[s] * 100 / pulses[n];
+      CHECK(load_position(motor, pulses[n], 4 * (long)pulses[n]));
+      CHECK_NEAR(motor.position_cdeg(), exact, 1.0);
+      CHECK(load_position(motor, pulses[n], -4 * (long)pulses[n]));
+      CHECK_NEAR(motor.position_cdeg(), -exact, 1.0);
+    }
+  }
+}
+
+// ------------------------------------
+// Centidegrees to pulses, seen through the relative move estimate
+// Without a speed map the estimate is pulses * 256 / speed.
+static void test_cdeg_to_pulses() {
+  const int spans[] = { 90, 360, 655 };
+  const int pulses[] = { 7, 3600, 32767 };
+  int s, n;
+  long cdeg, expect;
+  unsigned long est;
+
+  for (s = 0; s < 3; s++) {
+    for (n = 0; n < 3; n++) {
+      sim_reset();
+      Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, spans[s]);
+
+      motor.set_cal(pulses[n]);
+      motor.set_speed(100);
+      for (cdeg = 0; cdeg <= spans[s] * 100L; cdeg += max(1L, spans[s] * 100L / 500)) {
+        expect = lround((double)cdeg * pulses[n] / (spans[s] * 100.0));
+        est = motor.move_estimate(cdeg);
+        CHECK(est >= (unsigned long)max(0L, expect - 1) * 256 / 255);
+        CHECK(est <= (unsigned long)(expect + 1) * 256 / 255);
+      }
+    }
+  }
+}
+
+int main() {
+  test_pulses_to_cdeg();
+  test_cdeg_to_pulses();
+  return test_result("test_scale");
+}
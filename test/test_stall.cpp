@@ -0,0 +1,98 @@
+/*
+  test_stall.cpp - Stall detection on a polled encoder with a slow loop()
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+
+static unsigned int event_ms;
+static Plant *event_plant;
+static int jam_at;
+
+// The sketch does something slow with each event
+static void slow_event(int deg) {
+  delay(event_ms);
+  if (jam_at > 0 && deg >= jam_at) event_plant->jammed = true;
+}
+
+// ------------------------------------
+// Move 90 degrees with the given time away from loop() on each event
+// Returns the fault.
+static int move(unsigned int gap_ms, int jam_deg) {
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 0;
+  Plant plant(config);
+  Arduino_Motor motor(0, slow_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  event_ms = 0;
+  event_plant = &plant;
+  jam_at = jam_deg;
+  sim_add_device(&plant);
+  motor.set_cal(PULSES);
+  motor.set_speed(60);
+  // Learn the pulse interval first
+  CHECK(motor.move_to_position(10));
+  event_ms = gap_ms;
+  motor.move_to_position(100);
+  return motor.fault();
+}
+
+static void test_slow_loop() {
+  // Not a stall, loop() was away
+  CHECK_EQ(move(0, 0), MOTOR_FAULT_NONE);
+  CHECK_EQ(move(5, 0), MOTOR_FAULT_NONE);
+  CHECK_EQ(move(10, 0), MOTOR_FAULT_NONE);
+  // Still found once loop() is back watching
+  CHECK_EQ(move(0, 50), MOTOR_FAULT_STALL);
+  CHECK_EQ(move(5, 50), MOTOR_FAULT_STALL);
+}
+
+// ------------------------------------
+// A slow move after a fast one is not a stall
+// Near the dead band the interval grows much faster than the PWM falls so
+// the interval learnt at the higher PWM says nothing about the lower one.
+static void test_slow_after_fast() {
+  unsigned long long start;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = 0;
+  Plant plant(config);
+  Arduino_Motor motor(0, slow_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  event_ms = 0;
+  jam_at = 0;
+  sim_add_device(&plant);
+  motor.set_cal(PULSES);
+  motor.set_speed(60);
+  // Stopped at full speed
+  CHECK(motor.start_move_to_position(300));
+  start = sim_time_us();
+  while (sim_time_us() - start < 500000) motor.update();
+  motor.abort();
+  while (motor.update());
+  delay(300);
+
+  motor.set_speed(11);
+  CHECK(motor.move_to_position(90));
+  CHECK_EQ(motor.fault(), MOTOR_FAULT_NONE);
+  // Still found at the low speed
+  event_plant = &plant;
+  jam_at = 1;
+  motor.move_to_position(60);
+  CHECK_EQ(motor.fault(), MOTOR_FAULT_STALL);
+}
+
+int main() {
+  test_slow_loop();
+  test_slow_after_fast();
+  return test_result("test_stall");
+}
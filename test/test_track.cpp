@@ -0,0 +1,169 @@
+/*
+  test_track.cpp - Following a stream of timestamped targets
+*/
+
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define PULSES 3600
+#define START 9000          // cdeg
+#define RATE 1000           // cdeg/s
+#define STEP_MS 1000        // Between targets, as a sketch sends them
+#define RUN_MS 20000
+
+static void no_event(int) {
+}
+
+// Where the pass should be at time t ms from the start
+static long ideal(unsigned long t) {
+  return START + (long)((unsigned long long)t * RATE / 1000);
+}
+
+// Counts the output coming to a halt while it should be moving
+class StopCount : public SimDevice
+{
+  public:
+    StopCount(Plant *plant) : stops(0), running(false), armed(false), __plant(plant) {}
+    void step(double) {
+      bool now = fabs(__plant->speed) > 0.1 * RATE * PULSES / 36000.0;
+      if (armed && running && !now) stops++;
+      running = now;
+    }
+    int stops;
+    bool running;
+    bool armed;           // Once on the pass
+
+  private:
+    Plant *__plant;
+};
+
+struct TrackResult {
+  double worst;         // Output against the ideal in cdeg
+  double mean;
+  int stops;
+  long lib_mean;        // From tracking_error_mean()
+};
+
+// ------------------------------------
+// Follow the pass by tracking or with a move to each target in turn
+static TrackResult follow(bool tracking) {
+  TrackResult result;
+  unsigned long start, t, next;
+  double err, sum;
+  long n;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = START * PULSES / 36000;
+  Plant plant(config);
+  StopCount stops(&plant);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  // set_cal() takes the current position as home
+  motor.set_cal(PULSES);
+  plant.output -= config.start;
+  plant.motor -= config.start;
+  motor.set_speed(60);
+  CHECK(motor.move_to_position_cdeg(START));
+  motor.set_closed_loop(true);
+  motor.set_pid(256, 8, 512);
+  motor.set_deadband(1);
+  sim_add_device(&stops);
+
+  start = millis();
+  next = 0;
+  if (tracking) CHECK(motor.start_tracking());
+  result.worst = 0;
+  sum = 0;
+  n = 0;
+  for (t = 0; t < RUN_MS; t = millis() - start) {
+    if (t >= next) {
+      // Tracking keeps the queue full, moves go one target at a time
+      if (tracking) {
+        while (motor.track_target(ideal(next + STEP_MS), start + next + STEP_MS))
+          next += STEP_MS;
+      } else {
+        CHECK(motor.start_move_to_position_cdeg(ideal(next + STEP_MS)));
+        next += STEP_MS;
+      }
+    }
+    motor.update();
+    // Measured after the first segment has been caught up
+    if (t > STEP_MS) {
+      stops.armed = true;
+      err = plant.output * 36000.0 / PULSES - ideal(t);
+      result.worst = max(result.worst, fabs(err));
+      sum += fabs(err);
+      n++;
+    }
+  }
+  if (tracking) motor.stop_tracking();
+  result.mean = sum / n;
+  result.stops = stops.stops;
+  result.lib_mean = motor.tracking_error_mean();
+  printf("  %s: worst %4.0f cdeg, mean %4.0f cdeg, %d stops, library says max %ld mean %ld\n",
+    tracking ? "tracking" : "moves   ", result.worst, result.mean, result.stops,
+    motor.tracking_error_max(), motor.tracking_error_mean());
+  return result;
+}
+
+static void test_follow() {
+  TrackResult moves = follow(false);
+  TrackResult track = follow(true);
+
+  // Moves stop at every target, tracking runs on through them
+  CHECK_EQ(track.stops, 0);
+  CHECK(moves.stops >= RUN_MS / STEP_MS - 2);
+  // Within a degree and a half, mostly much closer
+  CHECK(track.worst < 150);
+  CHECK(track.mean < moves.mean / 4);
+  // The library's own measure agrees
+  CHECK_NEAR(track.lib_mean, track.mean, 10);
+}
+
+// ------------------------------------
+// A new target replaces the one being run to part way
+static void test_replace() {
+  unsigned long start;
+
+  sim_reset();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.start = START * PULSES / 36000;
+  Plant plant(config);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  // set_cal() takes the current position as home
+  motor.set_cal(PULSES);
+  plant.output -= config.start;
+  plant.motor -= config.start;
+  motor.set_speed(60);
+  CHECK(motor.move_to_position_cdeg(START));
+  motor.set_closed_loop(true);
+
+  CHECK(motor.start_tracking());
+  start = millis();
+  CHECK(motor.track_target(START + 9000, start + 4000));
+  while (millis() - start < 2000) motor.update();
+  // Half way there, turn back
+  CHECK(plant.output * 36000.0 / PULSES > START + 3000);
+  CHECK(motor.track_target(START - 3000, millis() + 2000, true));
+  while (millis() - start < 5000) motor.update();
+  CHECK(motor.busy());
+  CHECK_NEAR(plant.output * 36000.0 / PULSES, START - 3000, 30);
+  CHECK(labs(motor.tracking_error()) <= 20);
+  motor.stop_tracking();
+  CHECK_EQ(motor.fault(), MOTOR_FAULT_NONE);
+}
+
+int main() {
+  test_follow();
+  test_replace();
+  return test_result("test_track");
+}
@@ -0,0 +1,93 @@
+/*
+  test_vmap.cpp - Speed map built by calibration and kept in EEPROM, and
+  the speed measured while moving
+*/
+
+#include <EEPROM.h>
+#include "test.h"
+#include "arduino_motor.h"
+#include "plant.h"
+
+#define DIR 22
+#define PWM 4
+#define SENSOR 30
+#define LIMIT 24
+#define ADDR 0
+
+static void no_event(int) {
+}
+
+// ------------------------------------
+// A stiff geared drive that does not turn at the lower map steps
+static void test_stiff_drive() {
+  unsigned long estimate, loaded, start;
+  int count;
+
+  sim_reset();
+  EEPROM.sim_erase();
+  PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+  config.dead_pwm = 100;
+  Plant plant(config);
+  Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+  Arduino_Motor restarted(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+  sim_add_device(&plant);
+  motor.set_speed(60);
+  motor.set_backoff_speed(60);
+  count = motor.calibrate();
+  CHECK_EQ(motor.fault(), MOTOR_FAULT_NONE);
+  CHECK(count > 3000);
+
+  // The map that was built gives a real time for a move
+  estimate = motor.move_estimate(18000);
+  start = millis();
+  CHECK(motor.move_to_position(180));
+  printf("  180 degrees estimated %lu ms, took %lu ms\n", estimate, millis() - start);
+  CHECK_NEAR(estimate, millis() - start, 0.3 * estimate);
+
+  // Kept with the calibration
+  CHECK(motor.save_cal(ADDR));
+  CHECK(restarted.load_cal(ADDR));
+  restarted.set_speed(60);
+  estimate = motor.move_estimate(9000);
+  loaded = restarted.move_estimate(9000);
+  CHECK(estimate > 0);
+  CHECK_EQ(loaded, estimate);
+}
+
+// ------------------------------------
+// Measured speed against the plant, near the dead band and at full speed
+static void test_measured_speed() {
+  const int speeds[] = { 11, 30, 60, 100 };
+  unsigned long start;
+  double actual;
+  long measured;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    sim_reset();
+    PlantConfig config = plant_az(DIR, PWM, SENSOR, LIMIT);
+    config.start = 0;
+    Plant plant(config);
+    Arduino_Motor motor(0, no_event, DIR, PWM, SENSOR, LIMIT, 360);
+
+    sim_add_device(&plant);
+    motor.set_cal(3600);
+    motor.set_speed(speeds[i]);
+    CHECK(motor.start_move_to_position(300));
+    // Up to speed
+    start = millis();
+    while (millis() - start < 500) motor.update();
+    measured = motor.speed_cdeg();
+    actual = plant.speed * 36000.0 / 3600;
+    printf("  at %3d%%: measured %6ld cdeg/s, plant %6.0f cdeg/s\n", speeds[i], measured, actual);
+    CHECK_NEAR(measured, actual, 0.02 * actual + 10);
+    motor.abort();
+  }
+}
+
+int main() {
+  test_stiff_drive();
+  test_measured_speed();
+  return test_result("test_vmap");
+}